@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "codec.h"
+#include "histogram.h"
+#include "zip.h"
+#include "dictionary.h"
+
+/*
+* Runs every codec and filter over generated data of a few kinds and sizes
+* and prints one JSON object per line: the ratio and the throughput
+* percentiles (MB/s of input or decoded bytes) over the timed runs. Every run
+* is checked to decode back to its input, the exit status is 1 if any
+* didn't.
+*/
+#define DEFAULT_NUM_RUNS 5
+#define MAX_NUM_RUNS 1000
+#define QUICK_MAX_SIZE ( 1 << 20 )
+//the dictionary benchmark codes the corpus as separate messages of this size
+#define MESSAGE_SIZE 1024
+
+typedef enum CorpusKind {
+    CORPUS_TEXT,
+    CORPUS_RANDOM,
+    CORPUS_SKEWED,
+    CORPUS_NUMERIC,
+    NUM_CORPUS_KINDS
+} CorpusKind;
+
+static const char *corpusNames[NUM_CORPUS_KINDS] = { "text", "random", "skewed", "numeric" };
+static const size_t corpusSizes[] = { 1 << 16, 1 << 20, 1 << 23 };
+#define NUM_CORPUS_SIZES ( sizeof( corpusSizes ) / sizeof( corpusSizes[0] ) )
+
+//pipelines as the command line takes them, each one is a benchmark
+static const char *pipelines[] = {
+    "huffman",
+    "auto",
+    "rans",
+    "rans:0",
+    "lz",
+    "lwz",
+    "bwt",
+    "delta:bits",
+    "delta:byte",
+    "delta:stride4",
+    "delta:xor4",
+    "delta:stride4,lz",
+};
+#define NUM_PIPELINES ( sizeof( pipelines ) / sizeof( pipelines[0] ) )
+//lz runs at each of these levels
+static const uint lzLevels[] = { 1, 3, 6 };
+
+typedef struct Timings {
+    double *seconds;
+    uint numRuns;
+} Timings;
+
+//xorshift64*, the corpus only has to be the same on every run
+static uint64_t nextRandom( uint64_t* const state ) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ull;
+}
+
+/*
+* text     words from a fixed vocabulary, picked with a Zipf like skew
+* random   uniform bytes, nothing to gain
+* skewed   bytes whose probability halves with every step from 'a'
+* numeric  little endian 32 bit counters drifting by small steps
+*/
+static void generateCorpus( const CorpusKind kind, uint8_t *output, const size_t size ) {
+    static const char *words[] = {
+        "the", "of", "and", "block", "stream", "to", "in", "a", "key", "length", "table", "is", "for", "decode", "encode",
+        "symbol", "with", "count", "match", "offset", "huffman", "bits", "that", "buffer", "output", "input", "size", "each",
+        "thread", "pool", "header", "canonical", "when", "are", "this", "from", "by", "on", "be", "not", "delta", "filter"
+    };
+    const uint numWords = sizeof( words ) / sizeof( words[0] );
+    uint64_t state = 0x9E3779B97F4A7C15ull + kind;
+    size_t i = 0;
+
+    switch ( kind ) {
+        case CORPUS_TEXT:
+            while ( i < size ) {
+                //the smaller of two draws favours the front of the list
+                const uint first = nextRandom( &state ) % numWords, second = nextRandom( &state ) % numWords;
+                const char *word = words[first < second ? first : second];
+                for ( ; *word && i < size; ++word ) output[i++] = *word;
+                if ( i < size ) output[i++] = nextRandom( &state ) % 12 ? ' ' : nextRandom( &state ) % 3 ? '.' : '\n';
+            }
+            break;
+        case CORPUS_RANDOM:
+            for ( ; i + 8 <= size; i += 8 ) {
+                const uint64_t value = nextRandom( &state );
+                memcpy( output + i, &value, 8 );
+            }
+            for ( ; i < size; ++i ) output[i] = nextRandom( &state );
+            break;
+        case CORPUS_SKEWED:
+            for ( ; i < size; ++i ) {
+                const uint64_t value = nextRandom( &state ) | 1ull << 40;
+                output[i] = 'a' + __builtin_ctzll( value );
+            }
+            break;
+        case CORPUS_NUMERIC: {
+            uint32_t value = 1000000;
+            for ( ; i + 4 <= size; i += 4 ) {
+                value += nextRandom( &state ) % 17;
+                memcpy( output + i, &value, 4 );
+            }
+            for ( ; i < size; ++i ) output[i] = 0;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static double now( void ) {
+    struct timespec time;
+    clock_gettime( CLOCK_MONOTONIC, &time );
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static int orderDoublesAscending( const void *a, const void *b ) {
+    const double x = *( const double * ) a, y = *( const double * ) b;
+    return x < y ? -1 : x > y;
+}
+
+//nearest rank percentile of the throughput, the fastest run is p100
+static double throughputPercentile( const Timings* const timings, const size_t bytes, const double percentile ) {
+    //sorted fastest last once times are turned into rates, so take the rank
+    //from the slow end of the sorted times
+    uint rank = ( uint ) ( percentile / 100 * timings->numRuns + 0.999999 );
+    if ( rank < 1 ) rank = 1;
+    if ( rank > timings->numRuns ) rank = timings->numRuns;
+    return bytes / timings->seconds[timings->numRuns - rank] / 1e6;
+}
+
+static void printTimings( const char *name, Timings* const timings, const size_t bytes ) {
+    qsort( timings->seconds, timings->numRuns, sizeof( double ), orderDoublesAscending );
+    printf( ",\"%s_mbps_min\":%.2f,\"%s_mbps_p10\":%.2f,\"%s_mbps_p50\":%.2f,\"%s_mbps_p90\":%.2f,\"%s_mbps_max\":%.2f",
+            name, throughputPercentile( timings, bytes, 0 ), name, throughputPercentile( timings, bytes, 10 ),
+            name, throughputPercentile( timings, bytes, 50 ), name, throughputPercentile( timings, bytes, 90 ),
+            name, throughputPercentile( timings, bytes, 100 ) );
+}
+
+static void printResultStart( const char *benchmark, const CorpusKind kind, const size_t size, const uint numRuns ) {
+    printf( "{\"benchmark\":\"%s\",\"corpus\":\"%s\",\"size\":%zu,\"runs\":%u", benchmark, corpusNames[kind], size, numRuns );
+}
+
+/*
+* One untimed run to warm caches and page in the buffers, then numRuns timed
+* round trips. Returns false if a run fails or doesn't give the input back.
+*/
+static bool benchPipeline( const char *name, const Pipeline* const pipeline, const CorpusKind kind, const uint8_t *input, const size_t size,
+                           const uint numRuns, Timings* const compressTimings, Timings* const decompressTimings ) {
+    if ( !pipeline_checkInputSize( pipeline, size ) ) return true; //not applicable, skipped
+    const size_t capacity = pipeline_compressBound( pipeline, size );
+    uint8_t *compressed = malloc( capacity );
+    uint8_t *decompressed = malloc( size );
+    CodecContext *context = codecContext_create( pipeline );
+    bool success = compressed && decompressed && context;
+    size_t compressedSize = 0;
+
+    for ( uint run = 0; success && run <= numRuns; ++run ) {
+        double start = now();
+        compressedSize = codecContext_compress( context, input, size, compressed, capacity );
+        const double compressSeconds = now() - start;
+        start = now();
+        const size_t decompressedSize = codecContext_decompress( context, compressed, compressedSize, decompressed, size );
+        const double decompressSeconds = now() - start;
+        success = compressedSize && decompressedSize == size && !memcmp( input, decompressed, size );
+        if ( run ) {
+            compressTimings->seconds[run - 1] = compressSeconds;
+            decompressTimings->seconds[run - 1] = decompressSeconds;
+        }
+    }
+
+    printResultStart( name, kind, size, numRuns );
+    printf( ",\"ok\":%s", success ? "true" : "false" );
+    if ( success ) {
+        printf( ",\"compressed_size\":%zu,\"ratio\":%.4f", compressedSize, ( double ) size / compressedSize );
+        printTimings( "compress", compressTimings, size );
+        printTimings( "decompress", decompressTimings, size );
+    }
+    printf( "}\n" );
+    fflush( stdout );
+    free( compressed );
+    free( decompressed );
+    codecContext_close( context );
+    return success;
+}
+
+/*
+* Trains a dictionary on the corpus itself, then codes it as MESSAGE_SIZE
+* byte messages one after the other, like a stream of RPC payloads.
+*/
+static bool benchDictionary( const CorpusKind kind, const uint8_t *input, const size_t size, const uint numRuns,
+                             Timings* const compressTimings, Timings* const decompressTimings ) {
+    uint32_t counts[256];
+    uint64_t totalCounts[256];
+    histogram_count( input, size, counts );
+    for ( uint i = 0; i < 256; ++i ) totalCounts[i] = counts[i];
+    Dictionary *dictionary = dictionary_train( totalCounts );
+
+    const size_t numMessages = ( size + MESSAGE_SIZE - 1 ) / MESSAGE_SIZE;
+    const size_t messageCapacity = dictionary_compressBound( MESSAGE_SIZE );
+    uint8_t *compressed = malloc( numMessages * messageCapacity );
+    size_t *compressedSizes = malloc( numMessages * sizeof( size_t ) );
+    uint8_t *decompressed = malloc( size );
+    bool success = dictionary && compressed && compressedSizes && decompressed;
+    size_t compressedSize = 0;
+
+    for ( uint run = 0; success && run <= numRuns; ++run ) {
+        double start = now();
+        compressedSize = 0;
+        for ( size_t i = 0; i < numMessages; ++i ) {
+            const size_t messageSize = i + 1 < numMessages ? MESSAGE_SIZE : size - i * MESSAGE_SIZE;
+            compressedSizes[i] = dictionary_compress( dictionary, input + i * MESSAGE_SIZE, messageSize, compressed + i * messageCapacity, messageCapacity );
+            compressedSize += compressedSizes[i];
+        }
+        const double compressSeconds = now() - start;
+        start = now();
+        for ( size_t i = 0; i < numMessages && success; ++i ) {
+            size_t messageSize;
+            success = dictionary_decompress( dictionary, compressed + i * messageCapacity, compressedSizes[i], decompressed + i * MESSAGE_SIZE,
+                                             size - i * MESSAGE_SIZE, &messageSize );
+        }
+        const double decompressSeconds = now() - start;
+        success = success && !memcmp( input, decompressed, size );
+        if ( run ) {
+            compressTimings->seconds[run - 1] = compressSeconds;
+            decompressTimings->seconds[run - 1] = decompressSeconds;
+        }
+    }
+
+    printResultStart( "dictionary", kind, size, numRuns );
+    printf( ",\"ok\":%s", success ? "true" : "false" );
+    if ( success ) {
+        printf( ",\"compressed_size\":%zu,\"ratio\":%.4f", compressedSize, ( double ) size / compressedSize );
+        printTimings( "compress", compressTimings, size );
+        printTimings( "decompress", decompressTimings, size );
+    }
+    printf( "}\n" );
+    fflush( stdout );
+    dictionary_close( dictionary );
+    free( compressed );
+    free( compressedSizes );
+    free( decompressed );
+    return success;
+}
+
+//encode only benchmarks for the pieces without a decoder of their own here
+static bool benchEncodeOnly( const char *name, const CorpusKind kind, const uint8_t *input, const size_t size, const uint numRuns, Timings* const timings ) {
+    const size_t capacity = zip_gzipBound( size );
+    uint8_t *output = malloc( capacity );
+    Arena *arena = arena_create( 0 );
+    if ( !output || !arena ) {
+        free( output );
+        arena_close( arena );
+        return false;
+    }
+    size_t outputSize = 0;
+    uint32_t counts[256];
+    volatile uint32_t checksum = 0; //keeps the crc from being optimized out
+
+    for ( uint run = 0; run <= numRuns; ++run ) {
+        const double start = now();
+        if ( !strcmp( name, "deflate" ) ) {
+            arena_reset( arena );
+            outputSize = zip_deflate( input, size, output, capacity, ZIP_DEFAULT_LEVEL, arena );
+        } else if ( !strcmp( name, "crc32" ) ) {
+            checksum ^= zip_crc32( 0, input, size );
+        } else {
+            histogram_count( input, size, counts );
+        }
+        if ( run ) timings->seconds[run - 1] = now() - start;
+    }
+
+    printResultStart( name, kind, size, numRuns );
+    printf( ",\"ok\":true" );
+    if ( outputSize ) printf( ",\"compressed_size\":%zu,\"ratio\":%.4f", outputSize, ( double ) size / outputSize );
+    printTimings( "compress", timings, size );
+    printf( "}\n" );
+    fflush( stdout );
+    free( output );
+    arena_close( arena );
+    return strcmp( name, "deflate" ) || outputSize;
+}
+
+static void printUsage( FILE *output, const char *program ) {
+    fprintf( output,
+             "Usage: %s [-r runs] [-q] [-f filter]\n"
+             "  -r runs    timed runs per benchmark (default %u)\n"
+             "  -q         quick: sizes up to %u bytes only\n"
+             "  -f filter  only benchmarks whose name contains filter\n"
+             "Prints one JSON object per benchmark, corpus and size.\n",
+             program, DEFAULT_NUM_RUNS, QUICK_MAX_SIZE );
+}
+
+int main( int argc, char *argv[] ) {
+    uint numRuns = DEFAULT_NUM_RUNS;
+    size_t maxSize = SIZE_MAX;
+    const char *filter = "";
+    int option;
+    while ( ( option = getopt( argc, argv, "r:qf:h" ) ) != -1 ) {
+        switch ( option ) {
+            case 'r':
+                numRuns = strtoul( optarg, NULL, 10 );
+                if ( !numRuns || numRuns > MAX_NUM_RUNS ) {
+                    fprintf( stderr, "Invalid number of runs %s\n", optarg );
+                    return 1;
+                }
+                break;
+            case 'q':
+                maxSize = QUICK_MAX_SIZE;
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            case 'h':
+                printUsage( stdout, argv[0] );
+                return 0;
+            default:
+                printUsage( stderr, argv[0] );
+                return 1;
+        }
+    }
+
+    Timings compressTimings = { .seconds = malloc( sizeof( double ) * numRuns ), .numRuns = numRuns };
+    Timings decompressTimings = { .seconds = malloc( sizeof( double ) * numRuns ), .numRuns = numRuns };
+    uint8_t *corpus = malloc( corpusSizes[NUM_CORPUS_SIZES - 1] );
+    if ( !compressTimings.seconds || !decompressTimings.seconds || !corpus ) {
+        fprintf( stderr, "Cannot allocate corpus\n" );
+        return 1;
+    }
+
+    bool success = true;
+    for ( uint sizeIndex = 0; sizeIndex < NUM_CORPUS_SIZES && corpusSizes[sizeIndex] <= maxSize; ++sizeIndex ) {
+        const size_t size = corpusSizes[sizeIndex];
+        for ( uint kind = 0; kind < NUM_CORPUS_KINDS; ++kind ) {
+            generateCorpus( kind, corpus, size );
+
+            for ( uint i = 0; i < NUM_PIPELINES; ++i ) {
+                const bool isLz = !strncmp( pipelines[i], "lz", 2 ) || strstr( pipelines[i], ",lz" );
+                for ( uint level = 0; level < ( isLz ? sizeof( lzLevels ) / sizeof( lzLevels[0] ) : 1 ); ++level ) {
+                    char name[64];
+                    if ( isLz ) {
+                        snprintf( name, sizeof( name ), "%s/%u", pipelines[i], lzLevels[level] );
+                    } else {
+                        snprintf( name, sizeof( name ), "%s", pipelines[i] );
+                    }
+                    if ( !strstr( name, filter ) ) continue;
+                    Pipeline pipeline;
+                    if ( !pipeline_parse( pipelines[i], isLz ? lzLevels[level] : CODEC_DEFAULT_LEVEL, &pipeline ) ) return 1;
+                    success = benchPipeline( name, &pipeline, kind, corpus, size, numRuns, &compressTimings, &decompressTimings ) && success;
+                }
+            }
+
+            if ( strstr( "dictionary", filter ) ) {
+                success = benchDictionary( kind, corpus, size, numRuns, &compressTimings, &decompressTimings ) && success;
+            }
+
+            static const char *encodeOnly[] = { "deflate", "crc32", "histogram" };
+            for ( uint i = 0; i < sizeof( encodeOnly ) / sizeof( encodeOnly[0] ); ++i ) {
+                if ( !strstr( encodeOnly[i], filter ) ) continue;
+                success = benchEncodeOnly( encodeOnly[i], kind, corpus, size, numRuns, &compressTimings ) && success;
+            }
+        }
+    }
+
+    free( compressTimings.seconds );
+    free( decompressTimings.seconds );
+    free( corpus );
+    return success ? 0 : 1;
+}
@@ -0,0 +1,193 @@
+#include "adaptive.h"
+#include <stdio.h>
+#include <string.h>
+#include "huffman.h"
+#include "histogram.h"
+#include "delta.h"
+
+/*
+* What the sample saw: a histogram of the byte delta over every adjacent pair
+* inside a chunk. A delta of 0 is a byte repeating, so it counts runs as well.
+*/
+typedef struct Sample {
+    uint32_t deltaCounts[256];
+    uint64_t numPairs;
+} Sample;
+
+//ADAPTIVE_SAMPLE_CHUNKS chunks spread evenly from the first byte to the last, or the whole input if that's less
+static void takeSample( const uint8_t *input, const size_t inputSize, Sample* const sample ) {
+    memset( sample, 0, sizeof( Sample ) );
+    const bool whole = inputSize <= ADAPTIVE_SAMPLE_CHUNKS * ADAPTIVE_SAMPLE_CHUNK_SIZE;
+    const uint numChunks = whole ? 1 : ADAPTIVE_SAMPLE_CHUNKS;
+    const size_t chunkSize = whole ? inputSize : ADAPTIVE_SAMPLE_CHUNK_SIZE;
+    const size_t stride = whole ? 0 : ( inputSize - chunkSize ) / ( numChunks - 1 );
+    for ( uint chunk = 0; chunk < numChunks; ++chunk ) {
+        const uint8_t *start = input + chunk * stride;
+        for ( size_t i = 1; i < chunkSize; ++i ) {
+            ++sample->deltaCounts[( uint8_t ) ( start[i] - start[i - 1] )];
+        }
+        sample->numPairs += chunkSize - 1;
+    }
+}
+
+/*
+* Expected Huffman block size for entropyBits of information: whole bit keys
+* lose a few percent against the entropy and can't go under a bit per
+* character, and the header and jump table come on top.
+*/
+static uint64_t huffmanEstimate( const uint64_t entropyBits, const size_t inputSize, const uint numCharacters ) {
+    uint64_t bits = entropyBits + entropyBits / 32;
+    if ( bits < inputSize ) bits = inputSize;
+    return 1 + HUFFMAN_MAX_KEY_LENGTH + numCharacters + HUFFMAN_JUMP_TABLE_SIZE + bits / 8;
+}
+
+//the mode with the smallest estimate, stored unless something is expected to shrink the block
+static AdaptiveMode chooseMode( const uint8_t *input, const size_t inputSize, const uint32_t *counts, uint64_t* const huffmanSize ) {
+    uint numCharacters = 0;
+    for ( uint c = 0; c < 256; ++c ) numCharacters += counts[c] != 0;
+    *huffmanSize = huffmanEstimate( histogram_entropyBits( counts, 256, inputSize ), inputSize, numCharacters );
+    if ( numCharacters == 1 ) return ADAPTIVE_RUNS;
+
+    Sample sample;
+    takeSample( input, inputSize, &sample );
+    AdaptiveMode mode = ADAPTIVE_STORED;
+    uint64_t best = inputSize;
+    if ( *huffmanSize < best ) {
+        mode = ADAPTIVE_HUFFMAN;
+        best = *huffmanSize;
+    }
+    if ( !sample.numPairs ) return mode;
+    //a run is about two bytes, a byte and a short length
+    const uint64_t numRuns = 1 + ( sample.numPairs - sample.deltaCounts[0] ) * inputSize / sample.numPairs;
+    if ( numRuns * 2 < best ) {
+        mode = ADAPTIVE_RUNS;
+        best = numRuns * 2;
+    }
+    //the sample only approximates the block, so the delta has to win clearly to pay for its extra pass
+    const uint64_t deltaBits = histogram_entropyBits( sample.deltaCounts, 256, sample.numPairs ) * inputSize / sample.numPairs;
+    uint numDeltas = 0;
+    for ( uint c = 0; c < 256; ++c ) numDeltas += sample.deltaCounts[c] != 0;
+    const uint64_t deltaSize = huffmanEstimate( deltaBits, inputSize, numDeltas );
+    if ( deltaSize + deltaSize / 16 < best ) mode = ADAPTIVE_DELTA_HUFFMAN;
+    return mode;
+}
+
+//every run of the same byte as the byte and its length - 1, 0 if that doesn't fit in outputCapacity
+static size_t encodeRuns( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity ) {
+    size_t outputSize = 0;
+    for ( size_t i = 0; i < inputSize; ) {
+        size_t end = i + 1;
+        while ( end < inputSize && input[end] == input[i] ) ++end;
+        //the byte and a varint of up to 10 bytes
+        if ( outputSize + 11 > outputCapacity ) return 0;
+        output[outputSize++] = input[i];
+        size_t remaining = end - i - 1;
+        while ( remaining > 0x7F ) {
+            output[outputSize++] = ( remaining & 0x7F ) | 0x80;
+            remaining >>= 7;
+        }
+        output[outputSize++] = remaining;
+        i = end;
+    }
+    return outputSize;
+}
+
+static bool decodeRuns( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputSize ) {
+    size_t position = 0, written = 0;
+    while ( position < inputSize ) {
+        const uint8_t character = input[position++];
+        size_t length = 0;
+        for ( uint shift = 0;; shift += 7 ) {
+            if ( position == inputSize || shift > 56 ) return false;
+            const uint8_t byte = input[position++];
+            length |= ( size_t ) ( byte & 0x7F ) << shift;
+            if ( !( byte & 0x80 ) ) break;
+        }
+        if ( length >= outputSize - written ) return false;
+        memset( output + written, character, length + 1 );
+        written += length + 1;
+    }
+    return written == outputSize;
+}
+
+//the byte delta of input Huffman coded, 0 if that doesn't fit
+static size_t encodeDeltaHuffman( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity, const uint maxKeyLength,
+                                  Arena* const arena ) {
+    const size_t mark = arena_mark( arena );
+    uint8_t *filtered = arena_alloc( arena, inputSize );
+    size_t outputSize = 0;
+    if ( filtered ) {
+        memcpy( filtered, input, inputSize );
+        delta_encode( DELTA_FILTER_BYTE, filtered, inputSize );
+        outputSize = huffman_encodeBuffer( filtered, inputSize, output, outputCapacity, maxKeyLength, true );
+    }
+    arena_release( arena, mark );
+    return outputSize;
+}
+
+size_t adaptive_compressBound( const size_t inputSize ) {
+    return 1 + huffman_encodeBound( inputSize );
+}
+
+size_t adaptive_compressBlock( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity, const uint maxKeyLength,
+                               Arena* const arena ) {
+    if ( !inputSize || outputCapacity < 1 ) return 0;
+    uint32_t counts[256];
+    histogram_count( input, inputSize, counts );
+    uint64_t huffmanSize;
+    AdaptiveMode mode = chooseMode( input, inputSize, counts, &huffmanSize );
+
+    //anything coded has to come out smaller than storing, when an estimate
+    //was wrong the next best guess gets a go
+    uint8_t *payload = output + 1;
+    const size_t payloadCapacity = outputCapacity - 1 < inputSize ? outputCapacity - 1 : inputSize - 1;
+    size_t payloadSize = 0;
+    if ( mode == ADAPTIVE_RUNS ) {
+        payloadSize = encodeRuns( input, inputSize, payload, payloadCapacity );
+        if ( !payloadSize ) mode = huffmanSize < inputSize ? ADAPTIVE_HUFFMAN : ADAPTIVE_STORED;
+    }
+    if ( mode == ADAPTIVE_DELTA_HUFFMAN ) {
+        payloadSize = encodeDeltaHuffman( input, inputSize, payload, payloadCapacity, maxKeyLength, arena );
+        if ( !payloadSize ) mode = ADAPTIVE_HUFFMAN;
+    }
+    if ( mode == ADAPTIVE_HUFFMAN ) {
+        payloadSize = huffman_encodeBufferWithCounts( input, inputSize, counts, payload, payloadCapacity, maxKeyLength, true );
+        if ( !payloadSize ) mode = ADAPTIVE_STORED;
+    }
+    if ( mode == ADAPTIVE_STORED ) {
+        if ( inputSize > outputCapacity - 1 ) return 0;
+        memcpy( payload, input, inputSize );
+        payloadSize = inputSize;
+    }
+    output[0] = mode;
+    return 1 + payloadSize;
+}
+
+size_t adaptive_decompressBlock( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputSize, Arena* const arena ) {
+    bool valid = false;
+    if ( inputSize && outputSize ) {
+        const uint8_t *payload = input + 1;
+        const size_t payloadSize = inputSize - 1;
+        switch ( input[0] ) {
+            case ADAPTIVE_STORED:
+                valid = payloadSize == outputSize;
+                if ( valid ) memcpy( output, payload, outputSize );
+                break;
+            case ADAPTIVE_RUNS:
+                valid = decodeRuns( payload, payloadSize, output, outputSize );
+                break;
+            case ADAPTIVE_HUFFMAN:
+                valid = huffman_decodeBuffer( payload, payloadSize, output, outputSize, arena ) == outputSize;
+                break;
+            case ADAPTIVE_DELTA_HUFFMAN:
+                valid = huffman_decodeBuffer( payload, payloadSize, output, outputSize, arena ) == outputSize;
+                if ( valid ) delta_decode( DELTA_FILTER_BYTE, output, outputSize );
+                break;
+        }
+    }
+    if ( !valid ) {
+        fprintf( stderr, "Corrupt block (adaptive decompress)\n" );
+        return 0;
+    }
+    return outputSize;
+}
@@ -0,0 +1,45 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "arena.h"
+
+/*
+* Picks a coding per block instead of Huffman coding everything. The byte
+* histogram gives the order 0 entropy (and is handed on to Huffman if that
+* wins), a sample of ADAPTIVE_SAMPLE_CHUNKS spread out chunks gives the
+* number of runs and the entropy after a byte delta. Whichever estimate is
+* smallest is coded, and data that wouldn't shrink is stored without ever
+* building a table. A block is a mode byte followed by:
+*
+*   stored          the bytes as they are
+*   runs            per run the byte and its length - 1 as a LEB128 varint
+*   Huffman         a Huffman block (see huffman.h)
+*   delta Huffman   a Huffman block of the byte delta (see delta.h)
+*/
+typedef enum AdaptiveMode {
+    ADAPTIVE_STORED,
+    ADAPTIVE_RUNS,
+    ADAPTIVE_HUFFMAN,
+    ADAPTIVE_DELTA_HUFFMAN,
+    ADAPTIVE_NUM_MODES
+} AdaptiveMode;
+
+#define ADAPTIVE_SAMPLE_CHUNKS 16
+#define ADAPTIVE_SAMPLE_CHUNK_SIZE 1024
+
+//output capacity adaptive_compressBlock can never run out of
+size_t adaptive_compressBound( size_t inputSize );
+
+/*
+* Returns bytes written, 0 if inputSize is 0 or the result doesn't fit in
+* outputCapacity. Huffman keys are limited to maxKeyLength bits, the delta
+* buffer comes from arena.
+*/
+size_t adaptive_compressBlock( const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputCapacity, uint maxKeyLength, Arena *arena );
+
+//decodes exactly outputSize bytes, returns outputSize or 0 on malformed input
+size_t adaptive_decompressBlock( const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputSize, Arena *arena );
+
+#endif
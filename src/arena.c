@@ -0,0 +1,99 @@
+#include "arena.h"
+#include <string.h>
+
+//what malloc guarantees on every platform this builds on
+#define ARENA_ALIGNMENT 16
+
+//a chunk for an allocation that didn't fit, the data follows the header
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    uint8_t padding[ARENA_ALIGNMENT - sizeof( struct ArenaChunk * )];
+} ArenaChunk;
+
+struct Arena {
+    uint8_t *buffer;
+    size_t capacity;
+    size_t used;
+    ArenaChunk *chunks;
+    size_t chunkBytes; //handed out of chunks since the last reset
+    size_t peak;       //most ever handed out at once since the last reset
+};
+
+static size_t alignSize( const size_t size ) {
+    return ( size + ARENA_ALIGNMENT - 1 ) & ~( size_t ) ( ARENA_ALIGNMENT - 1 );
+}
+
+Arena *arena_create( const size_t initialSize ) {
+    Arena *arena = calloc( 1, sizeof( Arena ) );
+    if ( !arena ) return NULL;
+    if ( initialSize ) {
+        arena->buffer = malloc( alignSize( initialSize ) );
+        if ( !arena->buffer ) {
+            free( arena );
+            return NULL;
+        }
+        arena->capacity = alignSize( initialSize );
+    }
+    return arena;
+}
+
+static void freeChunks( Arena* const arena ) {
+    while ( arena->chunks ) {
+        ArenaChunk *next = arena->chunks->next;
+        free( arena->chunks );
+        arena->chunks = next;
+    }
+    arena->chunkBytes = 0;
+}
+
+void arena_close( Arena* const arena ) {
+    if ( !arena ) return;
+    freeChunks( arena );
+    free( arena->buffer );
+    free( arena );
+}
+
+void *arena_alloc( Arena* const arena, size_t size ) {
+    size = alignSize( size ? size : 1 );
+    void *memory;
+    if ( size <= arena->capacity - arena->used ) {
+        memory = arena->buffer + arena->used;
+        arena->used += size;
+    } else {
+        ArenaChunk *chunk = malloc( sizeof( ArenaChunk ) + size );
+        if ( !chunk ) return NULL;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->chunkBytes += size;
+        memory = chunk + 1;
+    }
+    if ( arena->used + arena->chunkBytes > arena->peak ) arena->peak = arena->used + arena->chunkBytes;
+    return memory;
+}
+
+void *arena_calloc( Arena* const arena, const size_t count, const size_t size ) {
+    if ( size && count > SIZE_MAX / size ) return NULL;
+    void *memory = arena_alloc( arena, count * size );
+    if ( memory ) memset( memory, 0, count * size );
+    return memory;
+}
+
+size_t arena_mark( const Arena* const arena ) {
+    return arena->used;
+}
+
+void arena_release( Arena* const arena, const size_t mark ) {
+    if ( mark < arena->used ) arena->used = mark;
+}
+
+void arena_reset( Arena* const arena ) {
+    if ( arena->chunks ) {
+        freeChunks( arena );
+        //a failed malloc leaves no buffer, every allocation then gets a chunk
+        free( arena->buffer );
+        arena->buffer = malloc( arena->peak );
+        arena->capacity = arena->buffer ? arena->peak : 0;
+    }
+    arena->used = 0;
+    arena->peak = 0;
+}
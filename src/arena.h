@@ -0,0 +1,36 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+/*
+* Bump allocator for the scratch memory of the block codecs. Nothing is freed
+* on its own, arena_reset drops everything at once between blocks. When an
+* allocation doesn't fit, it gets its own malloc'd chunk; the next reset then
+* replaces the main buffer with one large enough for everything that was
+* handed out, so after the first block or two coding more blocks of the same
+* size never calls malloc.
+*/
+typedef struct Arena Arena;
+
+//initialSize may be 0, the arena sizes itself from the first block
+Arena *arena_create( size_t initialSize );
+void arena_close( Arena *arena );
+
+//aligned like malloc, NULL only if the system is out of memory
+void *arena_alloc( Arena *arena, size_t size );
+void *arena_calloc( Arena *arena, size_t count, size_t size );
+
+/*
+* arena_release gives back everything allocated since arena_mark, for scratch
+* that is only needed for part of a block. Chunks allocated past the main
+* buffer are only given back by arena_reset.
+*/
+size_t arena_mark( const Arena *arena );
+void arena_release( Arena *arena, size_t mark );
+
+//makes all memory available again, regrowing the main buffer if it was too small
+void arena_reset( Arena *arena );
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef BITSTREAM_H
+#define BITSTREAM_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+/*
+* Bits are packed starting at the lowest bit of each byte, so a value written
+* with bitWriter_put comes back out of the low bits of a BitReader. Keys that
+* are meant to be read most significant bit first have to be reversed before
+* they are put.
+*
+* Both sides move whole 64 bit words in and out of memory (little endian
+* loads/stores), which is why writers need BITSTREAM_SLACK bytes of room past
+* the end of what they will actually fill.
+*/
+#define BITSTREAM_SLACK 8
+
+typedef struct BitWriter {
+    uint8_t *output;
+    size_t capacity; //bytes of output, including BITSTREAM_SLACK
+    size_t position; //next byte of output that bits will be flushed to
+    uint64_t bits;
+    uint count;      //number of valid bits in bits, always < 8 after a flush
+} BitWriter;
+
+typedef struct BitReader {
+    const uint8_t *input;
+    size_t inputSize;
+    size_t position; //next byte to load into bits
+    uint64_t bits;
+    uint count;      //number of valid bits in bits
+} BitReader;
+
+static inline BitWriter bitWriter_create( uint8_t *output, const size_t capacity ) {
+    return ( BitWriter ) { .output = output, .capacity = capacity, .position = 0, .bits = 0, .count = 0 };
+}
+
+/*
+* Adds the low length bits of value. Does not touch memory, so callers can put
+* up to 56 bits between flushes.
+*/
+static inline void bitWriter_put( BitWriter* const writer, const uint64_t value, const uint length ) {
+    writer->bits |= value << writer->count;
+    writer->count += length;
+}
+
+/*
+* Stores every complete byte held in the writer, leaving at most 7 bits. Always
+* stores a whole word, so position + 8 must be within capacity.
+*/
+static inline void bitWriter_flush( BitWriter* const writer ) {
+    memcpy( writer->output + writer->position, &writer->bits, 8 );
+    const uint numBytes = writer->count >> 3;
+    writer->position += numBytes;
+    writer->bits >>= numBytes * 8;
+    writer->count &= 7;
+}
+
+//bytes that can still be flushed before the writer runs into its slack
+static inline size_t bitWriter_available( const BitWriter* const writer ) {
+    return writer->capacity - BITSTREAM_SLACK - writer->position;
+}
+
+/*
+* Flushes everything including a final partial byte (padded with 0s) and
+* returns the total number of bytes written.
+*/
+static inline size_t bitWriter_finish( BitWriter* const writer ) {
+    bitWriter_flush( writer );
+    if ( writer->count ) {
+        writer->output[writer->position++] = ( uint8_t ) writer->bits;
+        writer->bits = 0;
+        writer->count = 0;
+    }
+    return writer->position;
+}
+
+static inline BitReader bitReader_create( const uint8_t *input, const size_t inputSize ) {
+    return ( BitReader ) { .input = input, .inputSize = inputSize, .position = 0, .bits = 0, .count = 0 };
+}
+
+/*
+* Tops the reader up to at least 56 bits. Anything past the end of the input
+* reads as 0, use bitReader_overrun to tell whether that padding got consumed.
+*/
+static inline void bitReader_refill( BitReader* const reader ) {
+    if ( reader->position + 8 <= reader->inputSize ) {
+        uint64_t word;
+        memcpy( &word, reader->input + reader->position, 8 );
+        reader->bits |= word << reader->count;
+        reader->position += ( 63 - reader->count ) >> 3;
+        reader->count |= 56;
+        return;
+    }
+    while ( reader->count <= 56 ) {
+        const uint64_t byte = reader->position < reader->inputSize ? reader->input[reader->position] : 0;
+        reader->bits |= byte << reader->count;
+        reader->position++;
+        reader->count += 8;
+    }
+}
+
+static inline uint64_t bitReader_peek( const BitReader* const reader, const uint length ) {
+    return reader->bits & ( ( ( uint64_t ) 1 << length ) - 1 );
+}
+
+static inline void bitReader_skip( BitReader* const reader, const uint length ) {
+    reader->bits >>= length;
+    reader->count -= length;
+}
+
+//peek and skip in one, length has to be below 64 and within the refilled bits
+static inline uint64_t bitReader_get( BitReader* const reader, const uint length ) {
+    const uint64_t value = bitReader_peek( reader, length );
+    bitReader_skip( reader, length );
+    return value;
+}
+
+//number of bits actually consumed from the input so far
+static inline size_t bitReader_consumed( const BitReader* const reader ) {
+    return reader->position * 8 - reader->count;
+}
+
+static inline bool bitReader_overrun( const BitReader* const reader ) {
+    return bitReader_consumed( reader ) > reader->inputSize * 8;
+}
+
+static inline void writeLE32( uint8_t* const output, const uint32_t value ) {
+    output[0] = value;
+    output[1] = value >> 8;
+    output[2] = value >> 16;
+    output[3] = value >> 24;
+}
+
+static inline uint32_t readLE32( const uint8_t *input ) {
+    return input[0] | input[1] << 8 | input[2] << 16 | ( uint32_t ) input[3] << 24;
+}
+
+static inline void writeLE64( uint8_t* const output, const uint64_t value ) {
+    writeLE32( output, value );
+    writeLE32( output + 4, value >> 32 );
+}
+
+static inline uint64_t readLE64( const uint8_t *input ) {
+    return readLE32( input ) | ( uint64_t ) readLE32( input + 4 ) << 32;
+}
+
+#endif
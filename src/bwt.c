@@ -1,3 +1,421 @@
 #include "bwt.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "huffman.h"
+#include "rans.h"
+#include "histogram.h"
+#include "bitstream.h"
+
+#define BLOCK_HEADER_SIZE 9
+#define MODE_STORED 0
+#define MODE_HUFFMAN 1
+#define MODE_RANS 2
+#define MODE_RAW 3
+//zero runs are written in bijective base 2 with these two symbols, every
+//other MTF index v is written as v + 1, with 255 escaping the top two
+#define RUN_A 0
+#define RUN_B 1
+#define ESCAPE 255
+
+/*
+* SA-IS (Nong, Zhang, Chan). The text is either the input bytes with a
+* virtual end marker (every byte is read as itself + 1 and position n - 1 as
+* 0), or a reduced problem of ints living inside the suffix array itself.
+* Either way the last symbol is a unique smallest one.
+*/
+typedef struct SaisText {
+    const void *data;
+    int length;
+    bool isBytes;
+} SaisText;
+
+static inline int charAt( const SaisText* const text, const int i ) {
+    if ( text->isBytes ) return i == text->length - 1 ? 0 : ( ( const uint8_t * ) text->data )[i] + 1;
+    return ( ( const int * ) text->data )[i];
+}
+
+//types are stored one bit per position, set means S-type
+static inline bool isSType( const uint8_t *types, const int i ) {
+    return types[i >> 3] >> ( i & 7 ) & 1;
+}
+
+static inline void setType( uint8_t *types, const int i, const bool sType ) {
+    if ( sType ) {
+        types[i >> 3] |= 1 << ( i & 7 );
+    } else {
+        types[i >> 3] &= ~( 1 << ( i & 7 ) );
+    }
+}
+
+//leftmost S-type: an S-type position right after an L-type one
+static inline bool isLms( const uint8_t *types, const int i ) {
+    return i > 0 && isSType( types, i ) && !isSType( types, i - 1 );
+}
+
+static void getBuckets( const SaisText* const text, int *buckets, const int alphabetSize, const bool ends ) {
+    memset( buckets, 0, sizeof( int ) * ( alphabetSize + 1 ) );
+    for ( int i = 0; i < text->length; ++i ) buckets[charAt( text, i )]++;
+    int sum = 0;
+    for ( int i = 0; i <= alphabetSize; ++i ) {
+        sum += buckets[i];
+        buckets[i] = ends ? sum : sum - buckets[i];
+    }
+}
+
+static void induceL( const SaisText* const text, const uint8_t *types, int *sa, int *buckets, const int alphabetSize ) {
+    getBuckets( text, buckets, alphabetSize, false );
+    for ( int i = 0; i < text->length; ++i ) {
+        const int j = sa[i] - 1;
+        if ( j >= 0 && !isSType( types, j ) ) sa[buckets[charAt( text, j )]++] = j;
+    }
+}
+
+static void induceS( const SaisText* const text, const uint8_t *types, int *sa, int *buckets, const int alphabetSize ) {
+    getBuckets( text, buckets, alphabetSize, true );
+    for ( int i = text->length - 1; i >= 0; --i ) {
+        const int j = sa[i] - 1;
+        if ( j >= 0 && isSType( types, j ) ) sa[--buckets[charAt( text, j )]] = j;
+    }
+}
+
+/*
+* Fills sa[0..length) for a text over 0..alphabetSize ending in a unique 0.
+* Sorts the LMS substrings by induction, names them, recurses if two names
+* are equal, then induces the full order from the sorted LMS suffixes.
+*/
+static bool suffixArray( const SaisText* const text, int *sa, const int alphabetSize, Arena* const arena ) {
+    const int n = text->length;
+    const size_t mark = arena_mark( arena );
+    uint8_t *types = arena_calloc( arena, n / 8 + 1, 1 );
+    int *buckets = arena_alloc( arena, sizeof( int ) * ( alphabetSize + 1 ) );
+    if ( !types || !buckets ) {
+        arena_release( arena, mark );
+        return false;
+    }
+
+    setType( types, n - 1, true );
+    setType( types, n - 2, false );
+    for ( int i = n - 3; i >= 0; --i ) {
+        const int current = charAt( text, i ), next = charAt( text, i + 1 );
+        setType( types, i, current < next || ( current == next && isSType( types, i + 1 ) ) );
+    }
+
+    //stage 1: sort the LMS substrings
+    getBuckets( text, buckets, alphabetSize, true );
+    for ( int i = 0; i < n; ++i ) sa[i] = -1;
+    for ( int i = 1; i < n; ++i ) {
+        if ( isLms( types, i ) ) sa[--buckets[charAt( text, i )]] = i;
+    }
+    induceL( text, types, sa, buckets, alphabetSize );
+    induceS( text, types, sa, buckets, alphabetSize );
+
+    //move them to the front, there are at most n / 2
+    int numLms = 0;
+    for ( int i = 0; i < n; ++i ) {
+        if ( isLms( types, sa[i] ) ) sa[numLms++] = sa[i];
+    }
+
+    //name them, equal substrings get equal names; the names go in the second
+    //half at position / 2, which can't collide since LMS positions are >= 2 apart
+    for ( int i = numLms; i < n; ++i ) sa[i] = -1;
+    int name = 0, previous = -1;
+    for ( int i = 0; i < numLms; ++i ) {
+        const int position = sa[i];
+        bool differs = false;
+        for ( int d = 0; d < n; ++d ) {
+            if ( previous == -1 || charAt( text, position + d ) != charAt( text, previous + d ) ||
+                 isSType( types, position + d ) != isSType( types, previous + d ) ) {
+                differs = true;
+                break;
+            } else if ( d > 0 && ( isLms( types, position + d ) || isLms( types, previous + d ) ) ) {
+                break;
+            }
+        }
+        if ( differs ) {
+            ++name;
+            previous = position;
+        }
+        sa[numLms + position / 2] = name - 1;
+    }
+    for ( int i = n - 1, j = n - 1; i >= numLms; --i ) {
+        if ( sa[i] >= 0 ) sa[j--] = sa[i];
+    }
+
+    //stage 2: order the LMS suffixes, recursing on the names if needed
+    int *reducedSa = sa;
+    int *reduced = sa + n - numLms;
+    if ( name < numLms ) {
+        const SaisText reducedText = { .data = reduced, .length = numLms, .isBytes = false };
+        if ( !suffixArray( &reducedText, reducedSa, name - 1, arena ) ) {
+            arena_release( arena, mark );
+            return false;
+        }
+    } else {
+        for ( int i = 0; i < numLms; ++i ) reducedSa[reduced[i]] = i;
+    }
+
+    //stage 3: place the sorted LMS suffixes at their bucket ends and induce
+    getBuckets( text, buckets, alphabetSize, true );
+    for ( int i = 1, j = 0; i < n; ++i ) {
+        if ( isLms( types, i ) ) reduced[j++] = i;
+    }
+    for ( int i = 0; i < numLms; ++i ) reducedSa[i] = reduced[reducedSa[i]];
+    for ( int i = numLms; i < n; ++i ) sa[i] = -1;
+    for ( int i = numLms - 1; i >= 0; --i ) {
+        const int j = sa[i];
+        sa[i] = -1;
+        sa[--buckets[charAt( text, j )]] = j;
+    }
+    induceL( text, types, sa, buckets, alphabetSize );
+    induceS( text, types, sa, buckets, alphabetSize );
+
+    arena_release( arena, mark );
+    return true;
+}
+
+bool bwt_forward( const uint8_t *input, const size_t inputSize, uint8_t *output, uint32_t* const primaryIndex, Arena* const arena ) {
+    if ( !inputSize || inputSize > BWT_MAX_BLOCK_SIZE ) return false;
+    const int n = inputSize + 1; //with the end marker
+    const size_t mark = arena_mark( arena );
+    int *sa = arena_alloc( arena, sizeof( int ) * n );
+    const SaisText text = { .data = input, .length = n, .isBytes = true };
+    if ( !sa || !suffixArray( &text, sa, 256, arena ) ) {
+        arena_release( arena, mark );
+        return false;
+    }
+
+    //row i ends in the byte before suffix sa[i], sa[0] is the end marker on
+    //its own so row 0 ends in the last byte; the row of suffix 0 would end
+    //in the marker and is left out
+    size_t outputIndex = 0;
+    for ( int i = 0; i < n; ++i ) {
+        if ( sa[i] == 0 ) {
+            *primaryIndex = i;
+        } else {
+            output[outputIndex++] = input[sa[i] - 1];
+        }
+    }
+    arena_release( arena, mark );
+    return true;
+}
+
+/*
+* Walks the LF mapping from the row of the end marker backwards through the
+* text. Each step needs the row's last byte and the row it maps to, so both
+* are packed into one uint32_t (row << 8 | byte) and every step is a single
+* random load. Rows fit in 24 bits since blocks are at most BWT_MAX_BLOCK_SIZE.
+*/
+bool bwt_inverse( const uint8_t *input, const size_t inputSize, const uint32_t primaryIndex, uint8_t *output, Arena* const arena ) {
+    if ( !inputSize || inputSize > BWT_MAX_BLOCK_SIZE || primaryIndex > inputSize || primaryIndex == 0 ) return false;
+    const size_t numRows = inputSize + 1;
+    const size_t mark = arena_mark( arena );
+    uint32_t *rows = arena_alloc( arena, sizeof( uint32_t ) * numRows );
+    if ( !rows ) return false;
+
+    //first row of each byte's bucket, the marker takes row 0
+    uint32_t starts[256] = {0};
+    for ( size_t i = 0; i < inputSize; ++i ) starts[input[i]]++;
+    uint32_t sum = 1;
+    for ( uint c = 0; c < 256; ++c ) {
+        const uint32_t count = starts[c];
+        starts[c] = sum;
+        sum += count;
+    }
+
+    for ( size_t row = 0, i = 0; row < numRows; ++row ) {
+        if ( row == primaryIndex ) {
+            rows[row] = 0;
+            continue;
+        }
+        const uint8_t byte = input[i++];
+        rows[row] = starts[byte]++ << 8 | byte;
+    }
+
+    uint32_t row = 0;
+    for ( size_t i = inputSize; i > 0; --i ) {
+        const uint32_t entry = rows[row];
+        output[i - 1] = entry;
+        row = entry >> 8;
+    }
+    arena_release( arena, mark );
+    return true;
+}
+
+/*
+* Move-to-front plus zero run coding in one pass. output needs 2 bytes per
+* input byte in the worst case. Returns bytes written.
+*/
+static size_t encodeMtfRuns( const uint8_t *input, const size_t inputSize, uint8_t *output ) {
+    uint8_t order[256];
+    for ( uint i = 0; i < 256; ++i ) order[i] = i;
+    size_t outputIndex = 0;
+    size_t run = 0;
+
+    for ( size_t i = 0; i <= inputSize; ++i ) {
+        uint index = 0;
+        if ( i < inputSize ) {
+            const uint8_t byte = input[i];
+            while ( order[index] != byte ) ++index;
+            if ( !index ) {
+                ++run;
+                continue;
+            }
+            memmove( order + 1, order, index );
+            order[0] = byte;
+        }
+
+        //flush the zero run before this index (bijective base 2)
+        while ( run ) {
+            if ( run & 1 ) {
+                output[outputIndex++] = RUN_A;
+                run = ( run - 1 ) >> 1;
+            } else {
+                output[outputIndex++] = RUN_B;
+                run = ( run - 2 ) >> 1;
+            }
+        }
+        if ( i == inputSize ) break;
+        if ( index < ESCAPE - 1 ) {
+            output[outputIndex++] = index + 1;
+        } else {
+            output[outputIndex++] = ESCAPE;
+            output[outputIndex++] = index - ( ESCAPE - 1 );
+        }
+    }
+    return outputIndex;
+}
+
+//returns false if the stream doesn't decode to exactly outputSize bytes
+static bool decodeMtfRuns( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputSize ) {
+    uint8_t order[256];
+    for ( uint i = 0; i < 256; ++i ) order[i] = i;
+    size_t outputIndex = 0;
+
+    for ( size_t i = 0; i < inputSize; ) {
+        if ( input[i] <= RUN_B ) {
+            size_t run = 0, weight = 1;
+            while ( i < inputSize && input[i] <= RUN_B ) {
+                run += ( input[i++] + 1 ) * weight;
+                weight <<= 1;
+                if ( run > outputSize ) return false;
+            }
+            if ( run > outputSize - outputIndex ) return false;
+            memset( output + outputIndex, order[0], run );
+            outputIndex += run;
+            continue;
+        }
+
+        uint index = input[i++] - 1;
+        if ( index == ESCAPE - 1 ) {
+            if ( i >= inputSize || input[i] > 1 ) return false;
+            index += input[i++];
+        }
+        if ( outputIndex >= outputSize ) return false;
+        const uint8_t byte = order[index];
+        memmove( order + 1, order, index );
+        order[0] = byte;
+        output[outputIndex++] = byte;
+    }
+    return outputIndex == outputSize;
+}
+
+size_t bwt_compressBound( const size_t inputSize ) {
+    return BLOCK_HEADER_SIZE + inputSize * 2 + BITSTREAM_SLACK;
+}
+
+size_t bwt_compressBlock( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity, Arena* const arena ) {
+    if ( !inputSize || inputSize > BWT_MAX_BLOCK_SIZE || outputCapacity < BLOCK_HEADER_SIZE ) return 0;
+    const size_t mark = arena_mark( arena );
+    uint8_t *transformed = arena_alloc( arena, inputSize * 3 );
+    if ( !transformed ) {
+        fprintf( stderr, "Cannot allocate buffers (bwt compress)\n" );
+        return 0;
+    }
+    uint8_t *runs = transformed + inputSize;
+
+    uint32_t primaryIndex;
+    size_t outputSize = 0;
+    if ( !bwt_forward( input, inputSize, transformed, &primaryIndex, arena ) ) {
+        fprintf( stderr, "Cannot build suffix array (bwt compress)\n" );
+        goto cleanup;
+    }
+    const size_t runsSize = encodeMtfRuns( transformed, inputSize, runs );
+
+    uint8_t *payload = output + BLOCK_HEADER_SIZE;
+    const size_t payloadCapacity = outputCapacity - BLOCK_HEADER_SIZE;
+    uint32_t counts[256];
+    histogram_count( runs, runsSize, counts );
+    size_t payloadSize = huffman_encodeBufferWithCounts( runs, runsSize, counts, payload, payloadCapacity, HUFFMAN_DEFAULT_MAX_KEY_LENGTH, true );
+    output[8] = MODE_HUFFMAN;
+    if ( !payloadSize || payloadSize >= runsSize ) {
+        payloadSize = runsSize;
+        output[8] = MODE_STORED;
+    }
+    //the runs lean heavily on the first few symbols, where rANS often does
+    //better than whole bit keys; it only gets the room it needs to win, and
+    //order 0 since MTF already took away what order 1 would find, and only
+    //when the entropy says it can win
+    if ( rans_worthTrying( counts, runsSize, payloadSize ) ) {
+        uint8_t *ransOutput = arena_alloc( arena, payloadSize - 1 );
+        const size_t ransSize = ransOutput ? rans_compressBlock( runs, runsSize, ransOutput, payloadSize - 1, 0, arena ) : 0;
+        if ( ransSize ) {
+            memcpy( payload, ransOutput, ransSize );
+            payloadSize = ransSize;
+            output[8] = MODE_RANS;
+        }
+    }
+    //the escapes can take the MTF/RLE stream past the input, then the input
+    //itself is stored, which also spares the decoder the inverse transform
+    if ( payloadSize >= inputSize ) {
+        if ( inputSize > payloadCapacity ) goto cleanup;
+        memcpy( payload, input, inputSize );
+        payloadSize = inputSize;
+        output[8] = MODE_RAW;
+    } else if ( output[8] == MODE_STORED ) {
+        if ( runsSize > payloadCapacity ) goto cleanup;
+        memcpy( payload, runs, runsSize );
+    }
+    writeLE32( output, primaryIndex );
+    writeLE32( output + 4, runsSize );
+    outputSize = BLOCK_HEADER_SIZE + payloadSize;
+
+cleanup:
+    arena_release( arena, mark );
+    return outputSize;
+}
+
+size_t bwt_decompressBlock( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputSize, Arena* const arena ) {
+    if ( inputSize < BLOCK_HEADER_SIZE || !outputSize || outputSize > BWT_MAX_BLOCK_SIZE ) return 0;
+    const uint32_t primaryIndex = readLE32( input );
+    const size_t runsSize = readLE32( input + 4 );
+    const uint8_t mode = input[8];
+    const uint8_t *payload = input + BLOCK_HEADER_SIZE;
+    const size_t payloadSize = inputSize - BLOCK_HEADER_SIZE;
+    if ( mode == MODE_RAW && payloadSize == outputSize ) {
+        memcpy( output, payload, outputSize );
+        return outputSize;
+    }
+    if ( runsSize > outputSize * 2 || mode >= MODE_RAW || ( mode == MODE_STORED && payloadSize != runsSize ) ) return 0;
+
+    const size_t mark = arena_mark( arena );
+    uint8_t *transformed = arena_alloc( arena, outputSize + runsSize );
+    if ( !transformed ) return 0;
+    uint8_t *runs = transformed + outputSize;
+    size_t result = 0;
+
+    if ( mode == MODE_STORED ) {
+        memcpy( runs, payload, runsSize );
+    } else if ( mode == MODE_HUFFMAN ) {
+        if ( huffman_decodeBuffer( payload, payloadSize, runs, runsSize, arena ) != runsSize ) goto cleanup;
+    } else if ( rans_decompressBlock( payload, payloadSize, runs, runsSize, arena ) != runsSize ) {
+        goto cleanup;
+    }
+    if ( !decodeMtfRuns( runs, runsSize, transformed, outputSize ) ) goto cleanup;
+    if ( bwt_inverse( transformed, outputSize, primaryIndex, output, arena ) ) result = outputSize;
+
+cleanup:
+    arena_release( arena, mark );
+    if ( !result ) fprintf( stderr, "Corrupt block (bwt decompress)\n" );
+    return result;
+}
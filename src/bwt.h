@@ -1,4 +1,40 @@
 #ifndef BWT_H
 #define BWT_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "arena.h"
+
+/*
+* Burrows-Wheeler transform over whole blocks, then move-to-front, then run
+* length coding of the zero runs MTF leaves behind, then Huffman or rANS,
+* whichever is smaller. The suffix
+* array is built with SA-IS in linear time. A block is:
+*
+*   4 byte primary index, 4 byte size of the MTF/RLE stream, 1 byte mode
+*   (0 stored, 1 Huffman, 2 rANS), then the stream
+*
+* or, when none of that comes out smaller than the input, mode 3 and the
+* input as it is (the index and the size are then meaningless).
+*/
+#define BWT_MAX_BLOCK_SIZE ( 1 << 23 )
+
+//output capacity bwt_compressBlock can never run out of
+size_t bwt_compressBound( size_t inputSize );
+
+//returns bytes written, 0 on empty or oversized input or allocation failure;
+//the suffix array and the MTF/RLE stream are allocated from arena
+size_t bwt_compressBlock( const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputCapacity, Arena *arena );
+
+//decodes exactly outputSize bytes, returns outputSize or 0 on malformed input
+size_t bwt_decompressBlock( const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputSize, Arena *arena );
+
+/*
+* The bare transform. The sorted rotations include an end marker that sorts
+* below every byte, its row isn't stored and primaryIndex says where it was.
+* output gets inputSize bytes.
+*/
+bool bwt_forward( const uint8_t *input, size_t inputSize, uint8_t *output, uint32_t *primaryIndex, Arena *arena );
+bool bwt_inverse( const uint8_t *input, size_t inputSize, uint32_t primaryIndex, uint8_t *output, Arena *arena );
 
 #endif
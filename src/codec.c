@@ -0,0 +1,350 @@
+#include "codec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "huffman.h"
+#include "lwz.h"
+#include "bwt.h"
+#include "rans.h"
+#include "adaptive.h"
+#include "bitstream.h"
+#include "stats.h"
+
+#define SIZE_PREFIX_BYTES 4
+
+//reads a whole decimal option into min..max
+static bool parseNumber( const char *option, const uint min, const uint max, uint* const value ) {
+    char *end;
+    const long number = strtol( option, &end, 10 );
+    if ( !*option || *end || number < min || number > max ) return false;
+    *value = number;
+    return true;
+}
+
+static bool huffmanInit( CodecStage* const stage, const uint level, const char *option ) {
+    ( void ) level;
+    stage->params.huffman.maxKeyLength = HUFFMAN_DEFAULT_MAX_KEY_LENGTH;
+    stage->params.huffman.interleaved = true;
+    return !option || parseNumber( option, 1, HUFFMAN_MAX_KEY_LENGTH, &stage->params.huffman.maxKeyLength );
+}
+
+static size_t huffmanCompressBound( const CodecStage* const stage, const size_t inputSize ) {
+    ( void ) stage;
+    return huffman_encodeBound( inputSize );
+}
+
+static size_t huffmanCompressBlock( const CodecStage* const stage, const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity,
+                                    Arena* const arena ) {
+    ( void ) arena;
+    return huffman_encodeBuffer( input, inputSize, output, outputCapacity, stage->params.huffman.maxKeyLength, stage->params.huffman.interleaved );
+}
+
+static bool lzInit( CodecStage* const stage, const uint level, const char *option ) {
+    stage->params.lz.level = level ? level : LZ_DEFAULT_LEVEL;
+    stage->params.lz.windowLog = LZ_DEFAULT_WINDOW_LOG;
+    return !option || parseNumber( option, LZ_MIN_WINDOW_LOG, LZ_MAX_WINDOW_LOG, &stage->params.lz.windowLog );
+}
+
+static size_t lzCompressBound( const CodecStage* const stage, const size_t inputSize ) {
+    ( void ) stage;
+    return lz_compressBound( inputSize );
+}
+
+static size_t lzCompressBlock( const CodecStage* const stage, const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity,
+                               Arena* const arena ) {
+    return lz_compressBlock( input, inputSize, output, outputCapacity, &stage->params.lz, arena );
+}
+
+//levels 1-9 map to 12-20 bit codes
+static bool lwzInit( CodecStage* const stage, const uint level, const char *option ) {
+    stage->params.lwzCodeBits = level ? 11 + level : LWZ_DEFAULT_CODE_BITS;
+    return !option || parseNumber( option, LWZ_MIN_CODE_BITS, LWZ_MAX_CODE_BITS, &stage->params.lwzCodeBits );
+}
+
+static size_t lwzCompressBound( const CodecStage* const stage, const size_t inputSize ) {
+    ( void ) stage;
+    return lwz_compressBound( inputSize );
+}
+
+static size_t lwzCompressBlock( const CodecStage* const stage, const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity,
+                                Arena* const arena ) {
+    return lwz_compressBlock( input, inputSize, output, outputCapacity, stage->params.lwzCodeBits, arena );
+}
+
+static bool bwtInit( CodecStage* const stage, const uint level, const char *option ) {
+    ( void ) stage;
+    ( void ) level;
+    return !option;
+}
+
+static size_t bwtCompressBound( const CodecStage* const stage, const size_t inputSize ) {
+    ( void ) stage;
+    return bwt_compressBound( inputSize );
+}
+
+static size_t bwtCompressBlock( const CodecStage* const stage, const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity,
+                                Arena* const arena ) {
+    ( void ) stage;
+    return bwt_compressBlock( input, inputSize, output, outputCapacity, arena );
+}
+
+static bool ransInit( CodecStage* const stage, const uint level, const char *option ) {
+    ( void ) level;
+    stage->params.ransMaxOrder = RANS_MAX_ORDER;
+    return !option || parseNumber( option, 0, RANS_MAX_ORDER, &stage->params.ransMaxOrder );
+}
+
+static size_t ransCompressBound( const CodecStage* const stage, const size_t inputSize ) {
+    ( void ) stage;
+    return rans_compressBound( inputSize );
+}
+
+static size_t ransCompressBlock( const CodecStage* const stage, const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity,
+                                 Arena* const arena ) {
+    return rans_compressBlock( input, inputSize, output, outputCapacity, stage->params.ransMaxOrder, arena );
+}
+
+//auto takes the same settings as huffman, which it codes with when that wins
+static size_t autoCompressBound( const CodecStage* const stage, const size_t inputSize ) {
+    ( void ) stage;
+    return adaptive_compressBound( inputSize );
+}
+
+static size_t autoCompressBlock( const CodecStage* const stage, const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity,
+                                 Arena* const arena ) {
+    return adaptive_compressBlock( input, inputSize, output, outputCapacity, stage->params.huffman.maxKeyLength, arena );
+}
+
+//delta blocks are the filter id followed by the filtered bytes
+static bool deltaInit( CodecStage* const stage, const uint level, const char *option ) {
+    ( void ) level;
+    stage->params.deltaFilter = DELTA_FILTER_BYTE;
+    return !option || delta_parseFilter( option, &stage->params.deltaFilter );
+}
+
+static size_t deltaCompressBound( const CodecStage* const stage, const size_t inputSize ) {
+    ( void ) stage;
+    return inputSize + 1;
+}
+
+static size_t deltaCompressBlock( const CodecStage* const stage, const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity,
+                                  Arena* const arena ) {
+    ( void ) arena;
+    if ( outputCapacity < inputSize + 1 ) return 0;
+    output[0] = stage->params.deltaFilter;
+    memcpy( output + 1, input, inputSize );
+    delta_encode( stage->params.deltaFilter, output + 1, inputSize );
+    return inputSize + 1;
+}
+
+static size_t deltaDecompressBlock( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputSize, Arena* const arena ) {
+    ( void ) arena;
+    if ( inputSize != outputSize + 1 || input[0] >= DELTA_NUM_FILTERS ) return 0;
+    memcpy( output, input + 1, outputSize );
+    delta_decode( input[0], output, outputSize );
+    return outputSize;
+}
+
+static const Codec codecs[] = {
+    { "huffman", CODEC_HUFFMAN, 0, huffmanInit, huffmanCompressBound, huffmanCompressBlock, huffman_decodeBuffer },
+    { "lz", CODEC_LZ, 0, lzInit, lzCompressBound, lzCompressBlock, lz_decompressBlock },
+    { "lwz", CODEC_LWZ, 0, lwzInit, lwzCompressBound, lwzCompressBlock, lwz_decompressBlock },
+    { "bwt", CODEC_BWT, BWT_MAX_BLOCK_SIZE, bwtInit, bwtCompressBound, bwtCompressBlock, bwt_decompressBlock },
+    { "delta", CODEC_DELTA, 0, deltaInit, deltaCompressBound, deltaCompressBlock, deltaDecompressBlock },
+    { "rans", CODEC_RANS, 0, ransInit, ransCompressBound, ransCompressBlock, rans_decompressBlock },
+    { "auto", CODEC_AUTO, 0, huffmanInit, autoCompressBound, autoCompressBlock, adaptive_decompressBlock },
+};
+#define NUM_CODECS ( sizeof( codecs ) / sizeof( codecs[0] ) )
+
+const Codec *codec_find( const char *name ) {
+    for ( uint i = 0; i < NUM_CODECS; ++i ) {
+        if ( !strcmp( codecs[i].name, name ) ) return &codecs[i];
+    }
+    return NULL;
+}
+
+const Codec *codec_findId( const uint8_t id ) {
+    for ( uint i = 0; i < NUM_CODECS; ++i ) {
+        if ( codecs[i].id == id ) return &codecs[i];
+    }
+    return NULL;
+}
+
+bool pipeline_parse( const char *description, const uint level, Pipeline* const pipeline ) {
+    if ( level > CODEC_MAX_LEVEL ) {
+        fprintf( stderr, "Invalid level %u (pipeline)\n", level );
+        return false;
+    }
+    char stageText[64];
+    pipeline->numStages = 0;
+    const char *start = description;
+    while ( true ) {
+        const size_t length = strcspn( start, "," );
+        if ( !length || length >= sizeof( stageText ) || pipeline->numStages == PIPELINE_MAX_STAGES ) {
+            fprintf( stderr, "Invalid pipeline %s (pipeline)\n", description );
+            return false;
+        }
+        memcpy( stageText, start, length );
+        stageText[length] = '\0';
+        char *option = strchr( stageText, ':' );
+        if ( option ) *option++ = '\0';
+
+        CodecStage* const stage = &pipeline->stages[pipeline->numStages++];
+        stage->codec = codec_find( stageText );
+        if ( !stage->codec ) {
+            fprintf( stderr, "Unknown codec %s (pipeline)\n", stageText );
+            return false;
+        }
+        if ( !stage->codec->init( stage, level, option ) ) {
+            fprintf( stderr, "Invalid option %s for %s (pipeline)\n", option ? option : "(none)", stageText );
+            return false;
+        }
+        if ( !start[length] ) return true;
+        start += length + 1;
+    }
+}
+
+bool pipeline_fromIds( const uint8_t *ids, const uint numIds, Pipeline* const pipeline ) {
+    if ( !numIds || numIds > PIPELINE_MAX_STAGES ) return false;
+    for ( uint i = 0; i < numIds; ++i ) {
+        CodecStage* const stage = &pipeline->stages[i];
+        stage->codec = codec_findId( ids[i] );
+        if ( !stage->codec || !stage->codec->init( stage, CODEC_DEFAULT_LEVEL, NULL ) ) return false;
+    }
+    pipeline->numStages = numIds;
+    return true;
+}
+
+bool pipeline_checkInputSize( const Pipeline* const pipeline, size_t inputSize ) {
+    for ( uint i = 0; i < pipeline->numStages; ++i ) {
+        const CodecStage* const stage = &pipeline->stages[i];
+        if ( stage->codec->maxInputSize && inputSize > stage->codec->maxInputSize ) {
+            fprintf( stderr, "Blocks of %zu bytes are too large for %s (pipeline)\n", inputSize, stage->codec->name );
+            return false;
+        }
+        inputSize = stage->codec->compressBound( stage, inputSize );
+    }
+    return true;
+}
+
+size_t pipeline_compressBound( const Pipeline* const pipeline, size_t inputSize ) {
+    for ( uint i = 0; i < pipeline->numStages; ++i ) {
+        inputSize = pipeline->stages[i].codec->compressBound( &pipeline->stages[i], inputSize );
+    }
+    return ( pipeline->numStages - 1 ) * SIZE_PREFIX_BYTES + inputSize;
+}
+
+//the largest output of any stage but the last, one scratch half holds it
+static size_t scratchHalfSize( const Pipeline* const pipeline, size_t inputSize ) {
+    size_t largest = 0;
+    for ( uint i = 0; i + 1 < pipeline->numStages; ++i ) {
+        inputSize = pipeline->stages[i].codec->compressBound( &pipeline->stages[i], inputSize );
+        if ( inputSize > largest ) largest = inputSize;
+    }
+    return largest;
+}
+
+/*
+* Stages between the first and the last take turns writing into the two
+* halves of a scratch buffer, stage i into half i % 2, so every stage reads
+* from one half and writes into the other.
+*/
+size_t pipeline_compressBlock( const Pipeline* const pipeline, const uint8_t *input, size_t inputSize, uint8_t *output, const size_t outputCapacity,
+                               Arena* const arena ) {
+    const uint numStages = pipeline->numStages;
+    const size_t prefixSize = ( numStages - 1 ) * SIZE_PREFIX_BYTES;
+    if ( outputCapacity < prefixSize ) return 0;
+    const size_t halfSize = scratchHalfSize( pipeline, inputSize );
+    const size_t mark = arena_mark( arena );
+    uint8_t *scratch = arena_alloc( arena, halfSize * 2 );
+    if ( !scratch ) {
+        fprintf( stderr, "Cannot allocate scratch (pipeline compress)\n" );
+        return 0;
+    }
+
+    for ( uint i = 0; i < numStages; ++i ) {
+        const CodecStage* const stage = &pipeline->stages[i];
+        const bool last = i + 1 == numStages;
+        uint8_t *stageOutput = last ? output + prefixSize : scratch + ( i % 2 ) * halfSize;
+        const size_t stageCapacity = last ? outputCapacity - prefixSize : halfSize;
+        const uint64_t start = stats_now();
+        const size_t stageSize = stage->codec->compressBlock( stage, input, inputSize, stageOutput, stageCapacity, arena );
+        stats_addStage( stage->codec->id, STATS_COMPRESS, inputSize, stageSize, start );
+        if ( !stageSize ) {
+            fprintf( stderr, "Stage %s failed (pipeline compress)\n", stage->codec->name );
+            arena_release( arena, mark );
+            return 0;
+        }
+        if ( !last ) writeLE32( output + i * SIZE_PREFIX_BYTES, stageSize );
+        input = stageOutput;
+        inputSize = stageSize;
+    }
+    arena_release( arena, mark );
+    return prefixSize + inputSize;
+}
+
+size_t pipeline_decompressBlock( const Pipeline* const pipeline, const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputSize,
+                                 Arena* const arena ) {
+    const uint numStages = pipeline->numStages;
+    const size_t prefixSize = ( numStages - 1 ) * SIZE_PREFIX_BYTES;
+    const size_t halfSize = scratchHalfSize( pipeline, outputSize );
+    if ( inputSize < prefixSize ) return 0;
+
+    //sizes[i] is what stage i wrote when compressing
+    size_t sizes[PIPELINE_MAX_STAGES];
+    for ( uint i = 0; i + 1 < numStages; ++i ) {
+        sizes[i] = readLE32( input + i * SIZE_PREFIX_BYTES );
+        if ( !sizes[i] || sizes[i] > halfSize ) return 0;
+    }
+    sizes[numStages - 1] = inputSize - prefixSize;
+
+    const size_t mark = arena_mark( arena );
+    uint8_t *scratch = arena_alloc( arena, halfSize * 2 );
+    if ( !scratch ) return 0;
+    const uint8_t *stageInput = input + prefixSize;
+    size_t result = outputSize;
+    for ( uint i = numStages; i-- > 0 && result; ) {
+        const CodecStage* const stage = &pipeline->stages[i];
+        uint8_t *stageOutput = i ? scratch + ( ( i - 1 ) % 2 ) * halfSize : output;
+        const size_t stageOutputSize = i ? sizes[i - 1] : outputSize;
+        const uint64_t start = stats_now();
+        if ( stage->codec->decompressBlock( stageInput, sizes[i], stageOutput, stageOutputSize, arena ) != stageOutputSize ) result = 0;
+        stats_addStage( stage->codec->id, STATS_DECOMPRESS, sizes[i], stageOutputSize, start );
+        stageInput = stageOutput;
+    }
+    arena_release( arena, mark );
+    return result;
+}
+
+struct CodecContext {
+    Pipeline pipeline;
+    Arena *arena;
+};
+
+CodecContext *codecContext_create( const Pipeline* const pipeline ) {
+    CodecContext *context = malloc( sizeof( CodecContext ) );
+    if ( !context ) return NULL;
+    context->pipeline = *pipeline;
+    context->arena = arena_create( 0 );
+    if ( !context->arena ) {
+        free( context );
+        return NULL;
+    }
+    return context;
+}
+
+void codecContext_close( CodecContext* const context ) {
+    if ( !context ) return;
+    arena_close( context->arena );
+    free( context );
+}
+
+size_t codecContext_compress( CodecContext* const context, const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity ) {
+    arena_reset( context->arena );
+    return pipeline_compressBlock( &context->pipeline, input, inputSize, output, outputCapacity, context->arena );
+}
+
+size_t codecContext_decompress( CodecContext* const context, const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputSize ) {
+    arena_reset( context->arena );
+    return pipeline_decompressBlock( &context->pipeline, input, inputSize, output, outputSize, context->arena );
+}
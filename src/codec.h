@@ -0,0 +1,115 @@
+#ifndef CODEC_H
+#define CODEC_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "lz.h"
+#include "delta.h"
+#include "arena.h"
+
+/*
+* Every block codec and filter behind one table of functions, so they can be
+* chained per block. Each codec's blocks describe themselves (whatever the
+* decoder needs, like a delta filter or a code width, is in the block), so
+* decoding only needs the codec ids and the sizes between stages.
+*/
+#define PIPELINE_MAX_STAGES 8
+//0 keeps every codec at its own default level
+#define CODEC_DEFAULT_LEVEL 0
+#define CODEC_MAX_LEVEL 9
+
+//recorded in streams, never renumber
+typedef enum CodecId {
+    CODEC_HUFFMAN = 1,
+    CODEC_LZ = 2,
+    CODEC_LWZ = 3,
+    CODEC_BWT = 4,
+    CODEC_DELTA = 5,
+    CODEC_RANS = 6,
+    CODEC_AUTO = 7
+} CodecId;
+
+typedef struct Codec Codec;
+
+//a codec with the settings it compresses with
+typedef struct CodecStage {
+    const Codec *codec;
+    union {
+        struct {
+            uint maxKeyLength;
+            bool interleaved;
+        } huffman;
+        LzParams lz;
+        uint lwzCodeBits;
+        uint ransMaxOrder;
+        DeltaFilter deltaFilter;
+    } params;
+} CodecStage;
+
+struct Codec {
+    const char *name;
+    CodecId id;
+    size_t maxInputSize; //0 if there is no limit
+    //fills the stage's settings from level (1-9 or CODEC_DEFAULT_LEVEL) and
+    //the text after "name:" (NULL if none), false if either is invalid
+    bool ( *init )( CodecStage *stage, uint level, const char *option );
+    size_t ( *compressBound )( const CodecStage *stage, size_t inputSize );
+    //returns bytes written, 0 on failure; working memory comes from arena and
+    //is given back before returning
+    size_t ( *compressBlock )( const CodecStage *stage, const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputCapacity, Arena *arena );
+    //decodes exactly outputSize bytes, returns outputSize or 0 on malformed input
+    size_t ( *decompressBlock )( const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputSize, Arena *arena );
+};
+
+const Codec *codec_find( const char *name );
+const Codec *codec_findId( uint8_t id );
+
+/*
+* Stages run first to last when compressing and last to first when
+* decompressing. A compressed block starts with the size of the data between
+* every pair of stages (4 bytes each), followed by what the last stage wrote.
+*/
+typedef struct Pipeline {
+    CodecStage stages[PIPELINE_MAX_STAGES];
+    uint numStages;
+} Pipeline;
+
+/*
+* Parses a comma separated list of stages like "delta:stride4,lz,huffman",
+* the text after a colon is the stage's option. Prints why and returns false
+* on unknown codecs or options.
+*/
+bool pipeline_parse( const char *description, uint level, Pipeline *pipeline );
+
+//pipeline made of codec ids as read back from a stream, settings at their defaults
+bool pipeline_fromIds( const uint8_t *ids, uint numIds, Pipeline *pipeline );
+
+//false (after printing which stage) if a stage can't take blocks of inputSize
+bool pipeline_checkInputSize( const Pipeline *pipeline, size_t inputSize );
+
+size_t pipeline_compressBound( const Pipeline *pipeline, size_t inputSize );
+
+//returns bytes written, 0 on failure; the buffers between stages and every
+//stage's working memory come from arena
+size_t pipeline_compressBlock( const Pipeline *pipeline, const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputCapacity, Arena *arena );
+
+//decodes exactly outputSize bytes, returns outputSize or 0 on malformed input
+size_t pipeline_decompressBlock( const Pipeline *pipeline, const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputSize, Arena *arena );
+
+/*
+* A pipeline with an arena of its own, for coding many blocks one after the
+* other: the arena is reset before every block, so once a context has seen
+* its largest block it doesn't allocate again. Contexts share nothing, so
+* each thread can have its own.
+*/
+typedef struct CodecContext CodecContext;
+
+//copies the pipeline, NULL if out of memory
+CodecContext *codecContext_create( const Pipeline *pipeline );
+void codecContext_close( CodecContext *context );
+
+//same returns as pipeline_compressBlock and pipeline_decompressBlock
+size_t codecContext_compress( CodecContext *context, const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputCapacity );
+size_t codecContext_decompress( CodecContext *context, const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputSize );
+
+#endif
@@ -1,57 +1,200 @@
 #include "delta.h"
-#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#define DELTA_X86 1
+#endif
 
-String deltaFileIntoString( const char *inputFileName ) {
-    FILE *inputFile = fopen( inputFileName, "r" );
-    if ( !inputFile ) {
-        fprintf( stderr, "Cannot open file %s (delta)\n", inputFileName );
-        return ( String ) { NULL, 0 };
-    }
-
-    fseek( inputFile, 0, SEEK_END );
-    const long inputFileSize = ftell( inputFile );
-    printf( "File Size: %li\n", inputFileSize );
-    fseek( inputFile, 0, SEEK_SET );
-
-    char *fileContents = malloc( sizeof( char ) * inputFileSize + 1 );
-    fileContents[inputFileSize] = '\0';
-    if ( !fileContents ) {
-        fprintf( stderr, "Cannot allocate enough memory for file %s (delta)\n", inputFileName );
-        fclose( inputFile );
-        return ( String ) { NULL, 0 };
-    }
-    fread( fileContents, 1, inputFileSize, inputFile );
-    uint lastBit = 0;
-    for ( long i = 0; i < inputFileSize - 1; ++i ) {
-        char currentByte = 0;
-        char fileByte = fileContents[i];
-        for ( uint8_t bitIndex = 7; bitIndex != 255; --bitIndex ) {
-            uint8_t currentBit = fileByte >> bitIndex & 1;
-            currentByte |= ( ( currentBit != lastBit ) & 1 ) << bitIndex;
-            lastBit = currentBit;
-        }
-        fileContents[i] = currentByte;
+/*
+* The bit delta marks every bit that differs from the bit before it, reading
+* each byte from its highest bit down and carrying the last bit of one byte
+* into the first bit of the next. For a whole byte that is
+*
+*     byte ^ ( byte >> 1 | previousByte << 7 )
+*
+* so every kernel below only needs each byte next to the one before it. They
+* all work in place, which is why the vector ones carry the previous block of
+* input in a register instead of loading it back from the buffer.
+*/
+
+static uint8_t encodeBitsByte( const uint8_t byte, const uint8_t previousByte ) {
+    return byte ^ ( byte >> 1 | ( uint8_t ) ( previousByte << 7 ) );
+}
+
+//8 bytes per step inside a 64 bit word, for CPUs without a vector kernel
+static void encodeBitsScalar( uint8_t *buffer, const size_t size, uint8_t previousByte ) {
+    size_t i = 0;
+    for ( ; i + 8 <= size; i += 8 ) {
+        uint64_t word;
+        memcpy( &word, buffer + i, 8 ); //little endian, byte k sits above byte k - 1
+        const uint64_t previousBytes = word << 8 | previousByte;
+        const uint64_t shifted = ( word >> 1 & 0x7F7F7F7F7F7F7F7FULL ) | ( previousBytes << 7 & 0x8080808080808080ULL );
+        previousByte = word >> 56;
+        word ^= shifted;
+        memcpy( buffer + i, &word, 8 );
+    }
+    for ( ; i < size; ++i ) {
+        const uint8_t byte = buffer[i];
+        buffer[i] = encodeBitsByte( byte, previousByte );
+        previousByte = byte;
+    }
+}
+
+#ifdef DELTA_X86
+//SSE2 is part of x86-64, so this is the baseline kernel there
+static void encodeBitsSse2( uint8_t *buffer, const size_t size, const uint8_t previousByte ) {
+    const __m128i lowMask = _mm_set1_epi8( 0x7F );
+    const __m128i highMask = _mm_set1_epi8( ( char ) 0x80 );
+    __m128i previous = _mm_insert_epi16( _mm_setzero_si128(), previousByte << 8, 7 ); //lands in byte 15
+    size_t i = 0;
+    for ( ; i + 16 <= size; i += 16 ) {
+        const __m128i current = _mm_loadu_si128( ( const __m128i * ) ( buffer + i ) );
+        const __m128i previousBytes = _mm_or_si128( _mm_slli_si128( current, 1 ), _mm_srli_si128( previous, 15 ) );
+        //16 bit shifts leak bits across the byte boundary, the masks drop them
+        const __m128i shifted = _mm_or_si128( _mm_and_si128( _mm_srli_epi16( current, 1 ), lowMask ),
+                                              _mm_and_si128( _mm_slli_epi16( previousBytes, 7 ), highMask ) );
+        _mm_storeu_si128( ( __m128i * ) ( buffer + i ), _mm_xor_si128( current, shifted ) );
+        previous = current;
     }
+    encodeBitsScalar( buffer + i, size - i, i ? ( uint8_t ) ( _mm_extract_epi16( previous, 7 ) >> 8 ) : previousByte );
+}
 
-    FILE *outputFile = fopen( "delta_output", "w" );
-    fwrite( fileContents, 1, inputFileSize, outputFile );
-    fclose( outputFile );
+__attribute__(( target( "avx2" ) ))
+static void encodeBitsAvx2( uint8_t *buffer, const size_t size, const uint8_t previousByte ) {
+    const __m256i lowMask = _mm256_set1_epi8( 0x7F );
+    const __m256i highMask = _mm256_set1_epi8( ( char ) 0x80 );
+    __m256i previous = _mm256_insert_epi8( _mm256_setzero_si256(), previousByte, 31 );
+    size_t i = 0;
+    for ( ; i + 32 <= size; i += 32 ) {
+        const __m256i current = _mm256_loadu_si256( ( const __m256i * ) ( buffer + i ) );
+        //byte shifts stay within 128 bit lanes, so the byte that crosses the
+        //middle comes from a lane swap: [previous high lane, current low lane]
+        const __m256i crossed = _mm256_permute2x128_si256( previous, current, 0x21 );
+        const __m256i previousBytes = _mm256_alignr_epi8( current, crossed, 15 );
+        const __m256i shifted = _mm256_or_si256( _mm256_and_si256( _mm256_srli_epi16( current, 1 ), lowMask ),
+                                                 _mm256_and_si256( _mm256_slli_epi16( previousBytes, 7 ), highMask ) );
+        _mm256_storeu_si256( ( __m256i * ) ( buffer + i ), _mm256_xor_si256( current, shifted ) );
+        previous = current;
+    }
+    encodeBitsSse2( buffer + i, size - i, i ? ( uint8_t ) _mm256_extract_epi8( previous, 31 ) : previousByte );
+}
+#endif
 
-    fclose( inputFile );
+static void encodeBits( uint8_t *buffer, const size_t size ) {
+#ifdef DELTA_X86
+    if ( __builtin_cpu_supports( "avx2" ) ) {
+        encodeBitsAvx2( buffer, size, 0 );
+    } else {
+        encodeBitsSse2( buffer, size, 0 );
+    }
+#else
+    encodeBitsScalar( buffer, size, 0 );
+#endif
+}
 
-    return ( String ) { .content = fileContents, .size = inputFileSize };
+/*
+* Undoing the bit delta makes every bit the XOR of all delta bits from the top
+* of its byte down to it, flipped if the last bit of the previous byte was 1.
+* Within a byte that is a prefix XOR of 3 shift steps. Each byte's flip is the
+* flip of the byte before it XOR that byte's parity (its lowest bit after the
+* prefix XOR), so across the 8 bytes of a word it's another prefix XOR, this
+* time over bytes.
+*/
+static void decodeBits( uint8_t *buffer, const size_t size ) {
+    uint64_t carry = 0; //last bit of the previous output byte
+    size_t i = 0;
+    for ( ; i + 8 <= size; i += 8 ) {
+        uint64_t word;
+        memcpy( &word, buffer + i, 8 );
+        word ^= word >> 1 & 0x7F7F7F7F7F7F7F7FULL;
+        word ^= word >> 2 & 0x3F3F3F3F3F3F3F3FULL;
+        word ^= word >> 4 & 0x0F0F0F0F0F0F0F0FULL;
+        //flip of byte k is carry ^ parity of bytes 0..k-1
+        uint64_t flips = ( word & 0x0101010101010101ULL ) << 8;
+        flips ^= flips << 8;
+        flips ^= flips << 16;
+        flips ^= flips << 32;
+        flips ^= carry * 0x0101010101010101ULL;
+        word ^= flips * 0xFF;
+        carry = word >> 56 & 1;
+        memcpy( buffer + i, &word, 8 );
+    }
+    for ( ; i < size; ++i ) {
+        uint8_t byte = buffer[i];
+        byte ^= byte >> 1;
+        byte ^= byte >> 2;
+        byte ^= byte >> 4;
+        byte ^= -( uint8_t ) carry;
+        carry = byte & 1;
+        buffer[i] = byte;
+    }
 }
 
-void deltaFileIntoFile( const char *inputFileName, const char *outputFileName ) {
-    FILE *outputFile = fopen( outputFileName, "w" );
-    if ( !outputFile ) {
-        fprintf( stderr, "Couldn't open output file %s (delta)\n", outputFileName );
-        return;
+/*
+* Byte deltas at a distance of stride: each byte becomes itself minus (or XOR)
+* the byte stride places before it, the first stride bytes are kept. Going
+* from the back keeps the bytes each step reads untouched. Decoding runs front
+* to back, adding (or XOR'ing) back bytes that are already decoded.
+*/
+static void encodeStride( uint8_t *buffer, const size_t size, const size_t stride, const bool useXor ) {
+    if ( size <= stride ) return;
+    if ( useXor ) {
+        for ( size_t i = size - 1; i >= stride; --i ) buffer[i] ^= buffer[i - stride];
+    } else {
+        for ( size_t i = size - 1; i >= stride; --i ) buffer[i] -= buffer[i - stride];
+    }
+}
+
+static void decodeStride( uint8_t *buffer, const size_t size, const size_t stride, const bool useXor ) {
+    if ( useXor ) {
+        for ( size_t i = stride; i < size; ++i ) buffer[i] ^= buffer[i - stride];
+    } else {
+        for ( size_t i = stride; i < size; ++i ) buffer[i] += buffer[i - stride];
+    }
+}
+
+static const struct {
+    const char *name;
+    uint8_t stride; //0 for the bit delta
+    bool useXor;
+} filterInfo[DELTA_NUM_FILTERS] = {
+    [DELTA_FILTER_BITS] = { "bits", 0, false },
+    [DELTA_FILTER_BYTE] = { "byte", 1, false },
+    [DELTA_FILTER_STRIDE2] = { "stride2", 2, false },
+    [DELTA_FILTER_STRIDE4] = { "stride4", 4, false },
+    [DELTA_FILTER_STRIDE8] = { "stride8", 8, false },
+    [DELTA_FILTER_XOR4] = { "xor4", 4, true },
+    [DELTA_FILTER_XOR8] = { "xor8", 8, true },
+};
+
+void delta_encode( const DeltaFilter filter, uint8_t *buffer, const size_t size ) {
+    if ( filter == DELTA_FILTER_BITS ) {
+        encodeBits( buffer, size );
+    } else {
+        encodeStride( buffer, size, filterInfo[filter].stride, filterInfo[filter].useXor );
+    }
+}
+
+void delta_decode( const DeltaFilter filter, uint8_t *buffer, const size_t size ) {
+    if ( filter == DELTA_FILTER_BITS ) {
+        decodeBits( buffer, size );
+    } else {
+        decodeStride( buffer, size, filterInfo[filter].stride, filterInfo[filter].useXor );
+    }
+}
+
+const char *delta_filterName( const DeltaFilter filter ) {
+    return filterInfo[filter].name;
+}
+
+bool delta_parseFilter( const char *name, DeltaFilter* const filter ) {
+    for ( uint i = 0; i < DELTA_NUM_FILTERS; ++i ) {
+        if ( !strcmp( name, filterInfo[i].name ) ) {
+            *filter = i;
+            return true;
+        }
     }
-    String string = deltaFileIntoString( inputFileName );
-    fwrite( string.content, 1, string.size, outputFile );
-    free( string.content );
-    fclose( outputFile );
+    return false;
 }
@@ -2,13 +2,37 @@
 #define DELTA_H
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdbool.h>
 
-typedef struct String {
-    char *content;
-    size_t size;
-} String;
+/*
+* Reversible pre-filters for compression, all of them work in place on a
+* buffer and are undone by delta_decode with the same filter:
+*
+* BITS     every bit becomes whether it differs from the bit before it
+*          (highest bit of each byte first, carried across bytes)
+* BYTE     every byte minus the byte before it
+* STRIDEn  every byte minus the byte n before it, for columns of n byte
+*          little endian integers
+* XORn     every byte XOR the byte n before it, for columns of floats
+*
+* The bit delta picks an AVX2/SSE2/scalar kernel for the running CPU.
+*/
+typedef enum DeltaFilter {
+    DELTA_FILTER_BITS,
+    DELTA_FILTER_BYTE,
+    DELTA_FILTER_STRIDE2,
+    DELTA_FILTER_STRIDE4,
+    DELTA_FILTER_STRIDE8,
+    DELTA_FILTER_XOR4,
+    DELTA_FILTER_XOR8,
+    DELTA_NUM_FILTERS
+} DeltaFilter;
 
-String deltaFileIntoString( const char *inputFileName );
-void deltaFileIntoFile( const char *inputFileName, const char *outputFileName );
+void delta_encode( DeltaFilter filter, uint8_t *buffer, size_t size );
+void delta_decode( DeltaFilter filter, uint8_t *buffer, size_t size );
+
+//short names ("bits", "stride4", ...) for command lines and stats
+const char *delta_filterName( DeltaFilter filter );
+bool delta_parseFilter( const char *name, DeltaFilter *filter );
 
 #endif
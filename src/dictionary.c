@@ -0,0 +1,172 @@
+#include "dictionary.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "huffman.h"
+#include "bitstream.h"
+#include "zip.h"
+
+static const uint8_t dictionaryMagic[4] = { 'C', 'M', 'P', 'D' };
+
+struct Dictionary {
+    uint32_t id;
+    HuffmanCode code;
+};
+
+//NULL if the key lengths aren't a usable code
+static Dictionary *createDictionary( const uint8_t *keyLengths ) {
+    Dictionary *dictionary = malloc( sizeof( Dictionary ) );
+    if ( !dictionary ) return NULL;
+    if ( !huffman_buildCode( keyLengths, &dictionary->code ) ) {
+        free( dictionary );
+        return NULL;
+    }
+    dictionary->id = zip_crc32( 0, keyLengths, 256 );
+    return dictionary;
+}
+
+Dictionary *dictionary_train( const uint64_t *counts ) {
+    //halve until every count fits in 32 bits, then give every character at
+    //least 1 so characters never seen in the samples still get a key
+    uint64_t largest = 0;
+    for ( uint i = 0; i < 256; ++i ) {
+        if ( counts[i] > largest ) largest = counts[i];
+    }
+    uint shift = 0;
+    while ( largest >> shift >= UINT32_MAX ) ++shift;
+    uint32_t scaled[256];
+    for ( uint i = 0; i < 256; ++i ) scaled[i] = ( counts[i] >> shift ) + 1;
+
+    uint8_t keyLengths[256];
+    if ( !huffman_buildKeyLengths( scaled, 256, HUFFMAN_TABLE_BITS, keyLengths ) ) return NULL;
+    return createDictionary( keyLengths );
+}
+
+Dictionary *dictionary_load( const char *fileName ) {
+    FILE *file = fopen( fileName, "rb" );
+    if ( !file ) {
+        fprintf( stderr, "Cannot open %s: %s\n", fileName, strerror( errno ) );
+        return NULL;
+    }
+    uint8_t contents[DICTIONARY_FILE_SIZE + 1];
+    const size_t size = fread( contents, 1, sizeof( contents ), file );
+    fclose( file );
+
+    Dictionary *dictionary = NULL;
+    if ( size == DICTIONARY_FILE_SIZE && !memcmp( contents, dictionaryMagic, 4 ) && contents[4] == DICTIONARY_VERSION ) {
+        dictionary = createDictionary( contents + 9 );
+    }
+    if ( dictionary && dictionary->id != readLE32( contents + 5 ) ) {
+        free( dictionary );
+        dictionary = NULL;
+    }
+    if ( !dictionary ) fprintf( stderr, "%s is not a valid dictionary (dictionary load)\n", fileName );
+    return dictionary;
+}
+
+bool dictionary_save( const Dictionary* const dictionary, const char *fileName ) {
+    uint8_t contents[DICTIONARY_FILE_SIZE];
+    memcpy( contents, dictionaryMagic, 4 );
+    contents[4] = DICTIONARY_VERSION;
+    writeLE32( contents + 5, dictionary->id );
+    memcpy( contents + 9, dictionary->code.keyLengths, 256 );
+
+    FILE *file = fopen( fileName, "wb" );
+    bool success = file && fwrite( contents, 1, sizeof( contents ), file ) == sizeof( contents );
+    if ( file ) success = !fclose( file ) && success;
+    if ( !success ) fprintf( stderr, "Cannot write %s (dictionary save)\n", fileName );
+    return success;
+}
+
+void dictionary_close( Dictionary* const dictionary ) {
+    free( dictionary );
+}
+
+uint32_t dictionary_id( const Dictionary* const dictionary ) {
+    return dictionary->id;
+}
+
+size_t dictionary_compressBound( const size_t inputSize ) {
+    return DICTIONARY_MAX_MESSAGE_HEADER_SIZE + huffman_encodeWithCodeBound( inputSize );
+}
+
+//table id and size with the stored flag, returns the header size
+static size_t writeHeader( const uint32_t tableId, const size_t decodedSize, const bool stored, uint8_t *output ) {
+    writeLE32( output, tableId );
+    size_t headerSize = 4;
+    uint64_t remaining = ( uint64_t ) decodedSize << 1 | stored;
+    do {
+        output[headerSize++] = ( remaining & 0x7F ) | ( remaining > 0x7F ? 0x80 : 0 );
+        remaining >>= 7;
+    } while ( remaining );
+    return headerSize;
+}
+
+size_t dictionary_compress( const Dictionary* const dictionary, const uint8_t *input, const size_t inputSize, uint8_t *output,
+                            const size_t outputCapacity ) {
+    if ( outputCapacity < DICTIONARY_MAX_MESSAGE_HEADER_SIZE || inputSize > DICTIONARY_MAX_MESSAGE_SIZE ) return 0;
+    //the flag doesn't change the header's length, so it can be rewritten
+    const size_t headerSize = writeHeader( dictionary->id, inputSize, false, output );
+    if ( !inputSize ) return headerSize;
+
+    const size_t keysSize = huffman_encodeWithCode( &dictionary->code, input, inputSize, output + headerSize, outputCapacity - headerSize );
+    if ( keysSize && keysSize < inputSize ) return headerSize + keysSize;
+    if ( inputSize > outputCapacity - headerSize ) return 0;
+    writeHeader( dictionary->id, inputSize, true, output );
+    memcpy( output + headerSize, input, inputSize );
+    return headerSize + inputSize;
+}
+
+//returns the header size, 0 if it is cut short
+static size_t readHeader( const uint8_t *input, const size_t inputSize, uint32_t* const tableId, size_t* const decodedSize, bool* const stored ) {
+    if ( inputSize < 5 ) return 0;
+    *tableId = readLE32( input );
+    uint64_t value = 0;
+    for ( size_t i = 4, shift = 0; i < inputSize && shift < 64; ++i, shift += 7 ) {
+        value |= ( uint64_t ) ( input[i] & 0x7F ) << shift;
+        if ( !( input[i] & 0x80 ) ) {
+            *decodedSize = value >> 1;
+            *stored = value & 1;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+bool dictionary_readHeader( const uint8_t *input, const size_t inputSize, uint32_t* const tableId, size_t* const decodedSize ) {
+    bool stored;
+    return readHeader( input, inputSize, tableId, decodedSize, &stored ) != 0;
+}
+
+bool dictionary_decompress( const Dictionary* const dictionary, const uint8_t *input, const size_t inputSize, uint8_t *output,
+                            const size_t outputCapacity, size_t* const outputSize ) {
+    uint32_t tableId;
+    bool stored;
+    const size_t headerSize = readHeader( input, inputSize, &tableId, outputSize, &stored );
+    if ( !headerSize ) {
+        fprintf( stderr, "Message too short (dictionary decompress)\n" );
+        return false;
+    }
+    if ( tableId != dictionary->id ) {
+        fprintf( stderr, "Message needs table %08x, not %08x (dictionary decompress)\n", tableId, dictionary->id );
+        return false;
+    }
+    if ( *outputSize > outputCapacity ) {
+        fprintf( stderr, "Message of %zu bytes too large (dictionary decompress)\n", *outputSize );
+        return false;
+    }
+    if ( !*outputSize ) return inputSize == headerSize;
+    if ( stored ) {
+        if ( inputSize - headerSize != *outputSize ) {
+            fprintf( stderr, "Corrupt message (dictionary decompress)\n" );
+            return false;
+        }
+        memcpy( output, input + headerSize, *outputSize );
+        return true;
+    }
+    if ( huffman_decodeWithCode( &dictionary->code, input + headerSize, inputSize - headerSize, output, *outputSize ) != *outputSize ) {
+        fprintf( stderr, "Corrupt message (dictionary decompress)\n" );
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,60 @@
+#ifndef DICTIONARY_H
+#define DICTIONARY_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+/*
+* Small messages with a Huffman code trained ahead of time on samples of
+* similar messages. The code is shared by both sides instead of being sent,
+* so a message has no canonical header, and coding it is a single pass with
+* no histogram. Every character gets a key, any message can be coded.
+*
+* A dictionary file is "CMPD", a version byte, the LE32 table id, then the
+* key length of each of the 256 characters. The table id is the CRC-32 of
+* the key lengths, so the same training gives the same id.
+*
+* A message is the LE32 table id of the dictionary it was coded with, a
+* LEB128 varint of the decoded size shifted up by one with the low bit set if
+* the message is stored, then the packed keys, or for a stored message the
+* bytes as they are. Messages the code wouldn't make smaller are stored, so
+* none grows by more than its header.
+*/
+#define DICTIONARY_VERSION 1
+#define DICTIONARY_FILE_SIZE ( 4 + 1 + 4 + 256 )
+#define DICTIONARY_MAX_MESSAGE_HEADER_SIZE ( 4 + 10 )
+//meant for messages of a few KiB, anything past this is refused both ways
+#define DICTIONARY_MAX_MESSAGE_SIZE ( 1 << 20 )
+
+typedef struct Dictionary Dictionary;
+
+/*
+* Trains on how often each character came up in the samples. The counts can
+* be summed over any number of samples, histogram_count gives them per buffer.
+*/
+Dictionary *dictionary_train( const uint64_t *counts );
+
+//NULL (after printing why) if the file can't be read or isn't a valid dictionary
+Dictionary *dictionary_load( const char *fileName );
+bool dictionary_save( const Dictionary *dictionary, const char *fileName );
+void dictionary_close( Dictionary *dictionary );
+
+uint32_t dictionary_id( const Dictionary *dictionary );
+
+//output capacity dictionary_compress can never run out of
+size_t dictionary_compressBound( size_t inputSize );
+
+//returns bytes written, 0 if the message doesn't fit in outputCapacity or
+//is over DICTIONARY_MAX_MESSAGE_SIZE
+size_t dictionary_compress( const Dictionary *dictionary, const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputCapacity );
+
+//reads which table a message needs and how large it decodes to, false if
+//the header is cut short
+bool dictionary_readHeader( const uint8_t *input, size_t inputSize, uint32_t *tableId, size_t *decodedSize );
+
+//decodes into output, false on a message for another table, one that is
+//larger than outputCapacity, or one that is malformed
+bool dictionary_decompress( const Dictionary *dictionary, const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputCapacity,
+                            size_t *outputSize );
+
+#endif
@@ -0,0 +1,277 @@
+#define _GNU_SOURCE
+#include "fileio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//mapped outputs start at this (or the first write if larger) and double from there
+#define OUTPUT_MAP_MIN_SIZE ( ( size_t ) 1 << 20 )
+//unmapped outputs collect small writes up to this, larger ones go straight out
+#define OUTPUT_BUFFER_SIZE ( ( size_t ) 1 << 20 )
+
+struct InputFile {
+    int fd;
+    const uint8_t *map; //the whole file when mapped
+    size_t mapSize;
+    size_t position;    //next byte of the mapping to hand out
+    bool failed;
+};
+
+struct OutputFile {
+    int fd;
+    uint8_t *map;       //mapped mode, the file is mapSize bytes long while open
+    size_t mapSize;
+    uint8_t *buffer;    //unmapped mode
+    size_t buffered;
+    size_t size;        //bytes written so far
+    char *fileName;     //what the temporary file replaces on close, NULL if written in place
+    char *temporaryName;
+    bool failed;
+};
+
+InputFile *inputFile_open( const char *fileName ) {
+    const bool standard = !strcmp( fileName, "-" );
+    const int fd = standard ? STDIN_FILENO : open( fileName, O_RDONLY );
+    if ( fd < 0 ) {
+        fprintf( stderr, "Cannot open %s: %s\n", fileName, strerror( errno ) );
+        return NULL;
+    }
+    InputFile *file = calloc( 1, sizeof( InputFile ) );
+    if ( !file ) {
+        if ( !standard ) close( fd );
+        return NULL;
+    }
+    file->fd = fd;
+
+    //stdin redirected from a file maps just as well, from wherever it is at
+    struct stat status;
+    const off_t start = lseek( fd, 0, SEEK_CUR );
+    if ( !fstat( fd, &status ) && S_ISREG( status.st_mode ) && start >= 0 && status.st_size > start ) {
+        void *map = mmap( NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if ( map != MAP_FAILED ) {
+            madvise( map, status.st_size, MADV_SEQUENTIAL );
+            file->map = map;
+            file->mapSize = status.st_size;
+            file->position = start;
+        }
+    }
+    return file;
+}
+
+void inputFile_close( InputFile* const file ) {
+    if ( !file ) return;
+    if ( file->map ) munmap( ( void * ) file->map, file->mapSize );
+    if ( file->fd != STDIN_FILENO ) close( file->fd );
+    free( file );
+}
+
+bool inputFile_isMapped( const InputFile* const file ) {
+    return file->map != NULL;
+}
+
+const uint8_t *inputFile_view( InputFile* const file, const size_t size, size_t* const available ) {
+    if ( !file->map ) return NULL;
+    const size_t remaining = file->mapSize - file->position;
+    *available = size < remaining ? size : remaining;
+    const uint8_t *view = file->map + file->position;
+    file->position += *available;
+    return view;
+}
+
+const uint8_t *inputFile_map( InputFile* const file, size_t* const size ) {
+    if ( !file->map ) return NULL;
+    madvise( ( void * ) file->map, file->mapSize, MADV_RANDOM );
+    *size = file->mapSize;
+    return file->map;
+}
+
+size_t inputFile_remaining( const InputFile* const file ) {
+    return file->map ? file->mapSize - file->position : 0;
+}
+
+size_t inputFile_read( InputFile* const file, uint8_t *buffer, const size_t size ) {
+    if ( file->map ) {
+        size_t available;
+        const uint8_t *view = inputFile_view( file, size, &available );
+        memcpy( buffer, view, available );
+        return available;
+    }
+    //pipes hand out short reads, keep going until size or the end
+    size_t total = 0;
+    while ( total < size ) {
+        const ssize_t numRead = read( file->fd, buffer + total, size - total );
+        if ( numRead < 0 && errno == EINTR ) continue;
+        if ( numRead < 0 ) file->failed = true;
+        if ( numRead <= 0 ) break;
+        total += numRead;
+    }
+    return total;
+}
+
+bool inputFile_error( const InputFile* const file ) {
+    return file->failed;
+}
+
+/*
+* A regular file, or one that doesn't exist yet, is written under a temporary
+* name next to it and only renamed over it once complete. Truncating it in
+* place would destroy the input when both are the same file, and a failed run
+* would leave half an output behind. Symbolic links are followed so the file
+* they point to is the one replaced. Anything else (a device, a pipe) is
+* opened and written as it is. Returns the descriptor, -1 on failure.
+*/
+static int openReplacement( OutputFile* const file, const char *fileName ) {
+    struct stat status;
+    const bool exists = !stat( fileName, &status );
+    if ( exists && !S_ISREG( status.st_mode ) ) return open( fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    file->fileName = exists ? realpath( fileName, NULL ) : strdup( fileName );
+    if ( !file->fileName ) return -1;
+    file->temporaryName = malloc( strlen( file->fileName ) + 8 );
+    if ( !file->temporaryName ) return -1;
+    sprintf( file->temporaryName, "%s.XXXXXX", file->fileName );
+    const int fd = mkstemp( file->temporaryName );
+    if ( fd < 0 ) {
+        free( file->temporaryName );
+        file->temporaryName = NULL;
+        return -1;
+    }
+    //mkstemp only allows the owner in, give it what open would have
+    const mode_t mask = umask( 0 );
+    umask( mask );
+    fchmod( fd, exists ? status.st_mode & 07777 : 0666 & ~mask );
+    return fd;
+}
+
+OutputFile *outputFile_open( const char *fileName ) {
+    const bool standard = !strcmp( fileName, "-" );
+    OutputFile *file = calloc( 1, sizeof( OutputFile ) );
+    if ( !file ) {
+        fprintf( stderr, "Cannot allocate output buffer for %s\n", fileName );
+        return NULL;
+    }
+    //read access too, a shared writable mapping needs it (mkstemp opens it so)
+    const int fd = standard ? STDOUT_FILENO : openReplacement( file, fileName );
+    if ( fd < 0 ) {
+        fprintf( stderr, "Cannot open %s: %s\n", fileName, strerror( errno ) );
+        free( file->fileName );
+        free( file );
+        return NULL;
+    }
+    struct stat status;
+    const bool mappable = !standard && !fstat( fd, &status ) && S_ISREG( status.st_mode );
+    if ( !mappable ) file->buffer = malloc( OUTPUT_BUFFER_SIZE );
+    if ( !mappable && !file->buffer ) {
+        fprintf( stderr, "Cannot allocate output buffer for %s\n", fileName );
+        if ( !standard ) close( fd );
+        if ( file->temporaryName ) unlink( file->temporaryName );
+        free( file->temporaryName );
+        free( file->fileName );
+        free( file );
+        return NULL;
+    }
+    file->fd = fd;
+    return file;
+}
+
+static bool writeAll( const int fd, const uint8_t *data, size_t size ) {
+    while ( size ) {
+        const ssize_t numWritten = write( fd, data, size );
+        if ( numWritten < 0 && errno == EINTR ) continue;
+        if ( numWritten <= 0 ) return false;
+        data += numWritten;
+        size -= numWritten;
+    }
+    return true;
+}
+
+/*
+* Makes room for size more bytes in a mapped output. The new part of the file
+* is allocated up front, so running out of disk space shows up here as an
+* error instead of as SIGBUS on a later store into the mapping. Small outputs
+* stay small: where fallocate is emulated every preallocated block gets
+* written.
+*/
+static bool growMap( OutputFile* const file, const size_t size ) {
+    size_t newSize = file->mapSize * 2;
+    if ( newSize < OUTPUT_MAP_MIN_SIZE ) newSize = OUTPUT_MAP_MIN_SIZE;
+    if ( newSize < file->size + size ) newSize = file->size + size;
+    const int error = posix_fallocate( file->fd, file->mapSize, newSize - file->mapSize );
+    if ( error ) {
+        errno = error;
+        return false;
+    }
+
+    void *map = file->map ? mremap( file->map, file->mapSize, newSize, MREMAP_MAYMOVE )
+                          : mmap( NULL, newSize, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0 );
+    if ( map == MAP_FAILED ) return false;
+    file->map = map;
+    file->mapSize = newSize;
+    return true;
+}
+
+static bool flushBuffer( OutputFile* const file ) {
+    if ( !file->buffered ) return true;
+    const bool success = writeAll( file->fd, file->buffer, file->buffered );
+    file->buffered = 0;
+    return success;
+}
+
+bool outputFile_write( OutputFile* const file, const void *data, const size_t size ) {
+    if ( file->failed ) return false;
+    if ( !file->buffer ) {
+        if ( file->size + size > file->mapSize && !growMap( file, size ) ) {
+            fprintf( stderr, "Cannot extend output: %s\n", strerror( errno ) );
+            file->failed = true;
+            return false;
+        }
+        memcpy( file->map + file->size, data, size );
+    } else if ( file->buffered + size <= OUTPUT_BUFFER_SIZE ) {
+        memcpy( file->buffer + file->buffered, data, size );
+        file->buffered += size;
+    } else {
+        //doesn't fit behind what is buffered: send that, then keep a small
+        //write for later and send a large one as it is
+        bool success = flushBuffer( file );
+        if ( success && size < OUTPUT_BUFFER_SIZE ) {
+            memcpy( file->buffer, data, size );
+            file->buffered = size;
+        } else if ( success ) {
+            success = writeAll( file->fd, data, size );
+        }
+        if ( !success ) {
+            fprintf( stderr, "Error writing output: %s\n", strerror( errno ) );
+            file->failed = true;
+            return false;
+        }
+    }
+    file->size += size;
+    return true;
+}
+
+bool outputFile_close( OutputFile* const file, const bool keep ) {
+    if ( !file ) return false;
+    bool success = !file->failed;
+    if ( file->buffer ) {
+        success = flushBuffer( file ) && success;
+        free( file->buffer );
+    }
+    if ( file->map ) {
+        munmap( file->map, file->mapSize );
+        success = !ftruncate( file->fd, file->size ) && success;
+    }
+    if ( file->fd != STDOUT_FILENO ) success = !close( file->fd ) && success;
+    if ( file->temporaryName ) {
+        if ( keep && success ) success = !rename( file->temporaryName, file->fileName );
+        if ( !keep || !success ) unlink( file->temporaryName );
+    }
+    if ( !success ) fprintf( stderr, "Error writing output\n" );
+    free( file->temporaryName );
+    free( file->fileName );
+    free( file );
+    return success;
+}
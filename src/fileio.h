@@ -0,0 +1,62 @@
+#ifndef FILEIO_H
+#define FILEIO_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+/*
+* File access for the stream layer. Regular input files are mapped whole
+* (read sequentially, so the kernel reads ahead aggressively) and blocks are
+* handed out as pointers into the mapping without copying. Regular output
+* files are mapped too, growing in preallocated chunks, so writes are a
+* memcpy into the page cache with no system call. Pipes and terminals fall
+* back to plain read/write in large chunks. "-" is stdin/stdout.
+*/
+typedef struct InputFile InputFile;
+typedef struct OutputFile OutputFile;
+
+//NULL (after printing why) if the file can't be opened
+InputFile *inputFile_open( const char *fileName );
+void inputFile_close( InputFile *file );
+
+bool inputFile_isMapped( const InputFile *file );
+
+//copies up to size bytes, fewer only at the end of the file or on an error
+size_t inputFile_read( InputFile *file, uint8_t *buffer, size_t size );
+
+/*
+* Mapped files only: returns a pointer to the next size bytes (fewer at the
+* end, see *available) and moves past them. Stays valid until the file is
+* closed. NULL if the file isn't mapped.
+*/
+const uint8_t *inputFile_view( InputFile *file, size_t size, size_t *available );
+
+/*
+* Mapped files only: the whole file for random access, which also stops the
+* kernel reading ahead. Doesn't move the read position. NULL if the file
+* isn't mapped.
+*/
+const uint8_t *inputFile_map( InputFile *file, size_t *size );
+
+//mapped files only: bytes from the read position to the end, 0 if the file isn't mapped
+size_t inputFile_remaining( const InputFile *file );
+
+//true once a read has failed, as opposed to just reaching the end
+bool inputFile_error( const InputFile *file );
+
+/*
+* NULL (after printing why) if the file can't be opened. A regular file is
+* only replaced once outputFile_close keeps it, so it can also be the input.
+*/
+OutputFile *outputFile_open( const char *fileName );
+
+bool outputFile_write( OutputFile *file, const void *data, size_t size );
+
+/*
+* Flushes, trims a mapped file to what was written and closes; false if
+* anything since opening failed. Unless keep is set (the caller succeeded)
+* a file that would replace a regular one is thrown away instead.
+*/
+bool outputFile_close( OutputFile *file, bool keep );
+
+#endif
@@ -0,0 +1,63 @@
+#include "histogram.h"
+#include <string.h>
+
+/*
+* Runs of the same byte make a single table increment each time wait on the
+* store of the one before it. Spreading bytes over 4 tables by position breaks
+* that chain, and the tables are summed at the end.
+*/
+void histogram_count( const uint8_t *input, const size_t inputSize, uint32_t *counts ) {
+    uint32_t subCounts[4][256];
+    memset( subCounts, 0, sizeof( subCounts ) );
+
+    size_t i = 0;
+    for ( ; i + 8 <= inputSize; i += 8 ) {
+        uint64_t word;
+        memcpy( &word, input + i, 8 );
+        ++subCounts[0][word & 0xFF];
+        ++subCounts[1][word >> 8 & 0xFF];
+        ++subCounts[2][word >> 16 & 0xFF];
+        ++subCounts[3][word >> 24 & 0xFF];
+        ++subCounts[0][word >> 32 & 0xFF];
+        ++subCounts[1][word >> 40 & 0xFF];
+        ++subCounts[2][word >> 48 & 0xFF];
+        ++subCounts[3][word >> 56];
+    }
+    for ( ; i < inputSize; ++i ) {
+        ++subCounts[0][input[i]];
+    }
+
+    for ( uint c = 0; c < 256; ++c ) {
+        counts[c] = subCounts[0][c] + subCounts[1][c] + subCounts[2][c] + subCounts[3][c];
+    }
+}
+
+void histogram_countPairs( const uint8_t *input, const size_t inputSize, uint32_t *counts ) {
+    memset( counts, 0, 256 * 256 * sizeof( uint32_t ) );
+    uint previous = 0;
+    for ( size_t i = 0; i < inputSize; ++i ) {
+        ++counts[previous << 8 | input[i]];
+        previous = input[i];
+    }
+}
+
+/*
+* log2 from the position of the top bit plus a quadratic fit of log2 over
+* the mantissa in [1, 2), good to about 0.005. Keeps libm out of the build.
+*/
+static double approximateLog2( const uint64_t value ) {
+    const uint exponent = 63 - __builtin_clzll( value );
+    const double mantissa = ( double ) value / ( ( uint64_t ) 1 << exponent );
+    return exponent + ( -0.34484843 * mantissa + 2.02466578 ) * mantissa - 1.67487759;
+}
+
+uint64_t histogram_entropyBits( const uint32_t *counts, const uint numCounts, const uint64_t total ) {
+    if ( !total ) return 0;
+    //sum of count * log2( total / count )
+    const double totalLog = approximateLog2( total );
+    double bits = 0;
+    for ( uint i = 0; i < numCounts; ++i ) {
+        if ( counts[i] ) bits += counts[i] * ( totalLog - approximateLog2( counts[i] ) );
+    }
+    return bits > 0 ? ( uint64_t ) bits : 0;
+}
@@ -0,0 +1,27 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+* Overwrites counts with how many times each byte value appears in input.
+* Counts are 32 bit, so input has to be under 4 GiB (blocks always are).
+*/
+void histogram_count( const uint8_t *input, size_t inputSize, uint32_t *counts );
+
+/*
+* Same for every pair of adjacent bytes: counts[a * 256 + b] is how many
+* times b follows a, with the first byte counted as following a 0. counts
+* holds 256 * 256 entries.
+*/
+void histogram_countPairs( const uint8_t *input, size_t inputSize, uint32_t *counts );
+
+/*
+* Order 0 entropy of numCounts counts summing to total, in bits: about the
+* fewest any code without context (Huffman, rANS order 0) could spend on
+* them, table not included. Within a fraction of a percent, it is meant for
+* choosing between codings, not for sizing buffers.
+*/
+uint64_t histogram_entropyBits( const uint32_t *counts, uint numCounts, uint64_t total );
+
+#endif
@@ -4,414 +4,613 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
-#include <errno.h>
-
-//makes up the encoding/decoding tree
-typedef struct Node {
-    struct Node *left;  //represented by '0' in key
-    struct Node *right; //represented by '1' in key
-    uint weight;        //number of times character appears in file
-    char character;      
-} Node;
-
-//used to save space when creating the encoding tree
-typedef struct PriorityNode {
-    struct Node *address; 
-    uint weight;  
-} PriorityNode;
+#include <string.h>
+#include "bitstream.h"
+#include "histogram.h"
+#include "stats.h"
 
 //holds information on encoding/decoding characters
 typedef struct EncoderEntry {
-    char character;    
-    uint64_t key;      //binary key used to encode/decode that character
-                       //keys that use more than 64 bits will overflow and not be stored
-                       //TODO: update to format that can handle up to the possible 255 length
-    uint8_t keyLength; //how many bits make up the key, 1 <= keyLength <= 255
+    uint8_t character;    
+    uint32_t key;      //binary key used to encode/decode that character
+    uint8_t keyLength; //how many bits make up the key, 1 <= keyLength <= HUFFMAN_MAX_KEY_LENGTH
 } EncoderEntry;
 
-/*
-* Recursively print the whole tree structure, giving the key of each character
-* within it
-*/
-static void printTree( const Node *node ) {
+//a leaf is one symbol, ties are broken by symbol so the result doesn't depend
+//on how qsort orders equal elements
+typedef struct WeightedSymbol {
+    uint64_t weight;
+    uint16_t symbol;
+} WeightedSymbol;
+
+static int orderWeightedSymbolsAscending( const void *symbol1, const void *symbol2 ) {
+    const WeightedSymbol *s1 = ( WeightedSymbol * ) symbol1;
+    const WeightedSymbol *s2 = ( WeightedSymbol * ) symbol2;
+    if ( s1->weight != s2->weight ) return s1->weight < s2->weight ? -1 : 1;
+    return s1->symbol < s2->symbol ? -1 : 1;
+}
 
-    static char key[256] = {0}; //stores the path to each node, always ends back at all '\0'
-    static uint treeLayer = 0;  //how deep down into the tree the function is, always returns to 0
+bool huffman_buildKeyLengths( const uint32_t *counts, const uint numSymbols, const uint maxKeyLength, uint8_t *keyLengths ) {
+    WeightedSymbol leaves[HUFFMAN_MAX_SYMBOLS];
+    uint numLeaves = 0;
+    if ( numSymbols > HUFFMAN_MAX_SYMBOLS || maxKeyLength < 1 || maxKeyLength > HUFFMAN_MAX_KEY_LENGTH ) return false;
 
-    if ( !node ) { 
-        return;
-    } else if ( node->character ) {
-        printf( "%c: %s\n", node->character, key );
-        return;
+    for ( uint i = 0; i < numSymbols; ++i ) {
+        keyLengths[i] = 0;
+        if ( counts[i] ) leaves[numLeaves++] = ( WeightedSymbol ) { .weight = counts[i], .symbol = i };
+    }
+    if ( !numLeaves ) return true;
+    if ( numLeaves == 1 ) { //a lone symbol still needs one bit to be written
+        keyLengths[leaves[0].symbol] = 1;
+        return true;
+    }
+    if ( numLeaves > 1u << maxKeyLength ) return false;
+    qsort( leaves, numLeaves, sizeof( WeightedSymbol ), orderWeightedSymbolsAscending );
+
+    /*
+    * Package-merge: starting at the deepest level, pair up neighbouring items
+    * into packages and merge those packages back in with the leaves, keeping
+    * everything sorted by weight. After maxKeyLength - 1 rounds the cheapest
+    * 2n - 2 items of the top list are the optimal length limited code, and a
+    * leaf's key length is how many of the chosen items contain it.
+    *
+    * Only which items are leaves needs to be kept per level: the chosen
+    * packages at one level are always the first ones of the level below.
+    */
+    int16_t levelItems[HUFFMAN_MAX_KEY_LENGTH][HUFFMAN_MAX_SYMBOLS * 2]; //leaf index, or -1 for a package
+    uint levelSizes[HUFFMAN_MAX_KEY_LENGTH];
+    uint64_t weights[HUFFMAN_MAX_SYMBOLS * 2];
+    uint64_t previousWeights[HUFFMAN_MAX_SYMBOLS * 2];
+
+    for ( uint i = 0; i < numLeaves; ++i ) {
+        levelItems[maxKeyLength - 1][i] = i;
+        previousWeights[i] = leaves[i].weight;
+    }
+    levelSizes[maxKeyLength - 1] = numLeaves;
+
+    for ( int level = maxKeyLength - 2; level >= 0; --level ) {
+        const uint numPackages = levelSizes[level + 1] / 2;
+        uint leafIndex = 0;
+        uint packageIndex = 0;
+        uint size = 0;
+        while ( leafIndex < numLeaves || packageIndex < numPackages ) {
+            const uint64_t packageWeight = packageIndex < numPackages ?
+                                           previousWeights[packageIndex * 2] + previousWeights[packageIndex * 2 + 1] :
+                                           UINT64_MAX;
+            if ( leafIndex < numLeaves && leaves[leafIndex].weight <= packageWeight ) {
+                levelItems[level][size] = leafIndex;
+                weights[size++] = leaves[leafIndex++].weight;
+            } else {
+                levelItems[level][size] = -1;
+                weights[size++] = packageWeight;
+                ++packageIndex;
+            }
+        }
+        levelSizes[level] = size;
+        memcpy( previousWeights, weights, size * sizeof( uint64_t ) );
     }
 
-    key[treeLayer++] = '0';
-    printTree( node->left );
-    key[treeLayer - 1] = '1';
-    printTree( node->right );
-    key[--treeLayer] = '\0';
+    uint numChosen = numLeaves * 2 - 2;
+    for ( uint level = 0; level < maxKeyLength && numChosen; ++level ) {
+        uint numPackagesChosen = 0;
+        for ( uint i = 0; i < numChosen; ++i ) {
+            if ( levelItems[level][i] < 0 ) {
+                ++numPackagesChosen;
+            } else {
+                ++keyLengths[leaves[levelItems[level][i]].symbol];
+            }
+        }
+        numChosen = numPackagesChosen * 2;
+    }
+    return true;
+}
 
+//canonical order is shortest keys first, then by character
+static int orderEncoderEntryCanonically( const void *entry1, const void *entry2 ) {
+    const EncoderEntry *e1 = ( EncoderEntry * ) entry1;
+    const EncoderEntry *e2 = ( EncoderEntry * ) entry2;
+    if ( e1->keyLength != e2->keyLength ) return e1->keyLength < e2->keyLength ? -1 : 1;
+    return e1->character < e2->character ? -1 : 1;
 }
 
 /*
-* Prints the bits of the binary given up to the requested length, prints in
-* the same order as it appears left to right when you use left/right shift
+* Assigns canonical keys to a table already sorted canonically: each key is the
+* previous one plus 1, shifted left by however much longer it is.
 */
-static void printBinary( const uint binary, const uint length ) {
+static void assignCanonicalKeys( EncoderEntry* const table, const uint numCharacters ) {
+    table[0].key = 0;
+    for ( uint i = 1; i < numCharacters; ++i ) {
+        table[i].key = ( table[i - 1].key + 1 ) << ( table[i].keyLength - table[i - 1].keyLength );
+    }
+}
+
+//reverses the lowest length bits of key, keys are written starting from their
+//highest bit while the bit streams fill bytes from the lowest bit up
+static uint32_t reverseKey( uint64_t key, const uint length ) {
+    uint32_t reversed = 0;
     for ( uint i = 0; i < length; ++i ) {
-       printf( "%c", binary >> ( length - 1 - i ) & 1 ? '1' : '0' );
+        reversed = ( reversed << 1 ) | ( key & 1 );
+        key >>= 1;
+    }
+    return reversed;
+}
+
+void huffman_buildCanonicalKeys( const uint8_t *keyLengths, const uint numSymbols, uint16_t *keys ) {
+    uint lengthCounts[HUFFMAN_MAX_KEY_LENGTH + 1] = {0};
+    for ( uint i = 0; i < numSymbols; ++i ) lengthCounts[keyLengths[i]]++;
+    lengthCounts[0] = 0;
+
+    //first key of each length, same rule as assignCanonicalKeys
+    uint32_t nextKeys[HUFFMAN_MAX_KEY_LENGTH + 1];
+    uint32_t key = 0;
+    for ( uint length = 1; length <= HUFFMAN_MAX_KEY_LENGTH; ++length ) {
+        key = ( key + lengthCounts[length - 1] ) << 1;
+        nextKeys[length] = key;
+    }
+    for ( uint i = 0; i < numSymbols; ++i ) {
+        keys[i] = keyLengths[i] ? reverseKey( nextKeys[keyLengths[i]]++, keyLengths[i] ) : 0;
     }
-    printf( " (%u)", binary );
 }
 
 /*
-* Runs the initial setup of the encoder table, which holds information about the
-* key and keyLength for each character.
-*
-* Can NOT be used multiple times in one run, tableIndex will not be
-* set back to 0
+* Fills table with every character that has a count, sorted canonically and
+* with keys assigned. Returns the number of characters in the table.
 */
-static void setupEncoderTable( const Node *node, EncoderEntry* const table ) {
+static uint buildEncoderTable( const uint32_t *characterCounts, const uint maxKeyLength, EncoderEntry* const table ) {
+    uint8_t keyLengths[256];
+    if ( !huffman_buildKeyLengths( characterCounts, 256, maxKeyLength, keyLengths ) ) return 0;
+
+    uint numCharacters = 0;
+    for ( uint i = 0; i < 256; ++i ) {
+        if ( !keyLengths[i] ) continue;
+        table[numCharacters++] = ( EncoderEntry ) { 
+                                                    .character = i,
+                                                    .key = 0,
+                                                    .keyLength = keyLengths[i]
+                                                  };
+    }
+    if ( !numCharacters ) return 0;
+    qsort( table, numCharacters, sizeof( EncoderEntry ), orderEncoderEntryCanonically );
+    assignCanonicalKeys( table, numCharacters );
+    return numCharacters;
+}
 
-    static uint64_t key = 0;
-    static uint treeLayer = 0;
-    static uint8_t tableIndex = 0;
+/*
+* Writes the max key length (with HUFFMAN_INTERLEAVED_FLAG or'd in if the keys
+* are split into streams), the number of keys at each length 1..max (a count
+* of 256 wraps to 0), then every character in canonical order. output needs
+* room for HUFFMAN_MAX_HEADER_SIZE bytes. Returns bytes written.
+*/
+static size_t writeCanonicalHeader( const EncoderEntry *table, const uint numCharacters, const bool interleaved, uint8_t* const output ) {
+    const uint8_t maxKeyLength = table[numCharacters - 1].keyLength;
+    output[0] = maxKeyLength | ( interleaved ? HUFFMAN_INTERLEAVED_FLAG : 0 );
+    memset( output + 1, 0, maxKeyLength );
+    for ( uint i = 0; i < numCharacters; ++i ) {
+        output[table[i].keyLength]++;
+        output[1 + maxKeyLength + i] = table[i].character;
+    }
+    return 1 + maxKeyLength + numCharacters;
+}
 
-    if ( !node ) {
-        return;
-    } else if ( node->character ) {
-        table[tableIndex] = ( EncoderEntry ) {
-                                               .character = node->character,
-                                               .key = key,
-                                               .keyLength = treeLayer
-                                             };
-        tableIndex++;
-        return;
-    }
-    treeLayer++;
-    setupEncoderTable( node->left, table );
-    key ^=  1 << ( treeLayer - 1 );
-    setupEncoderTable( node->right, table );
-    key ^= 1 << ( treeLayer - 1 ); 
-    treeLayer--;
+/*
+* Turns the canonical table into per character keys ready for a BitWriter,
+* already reversed so the highest bit of each key goes out first.
+*/
+static void buildWriterKeys( const EncoderEntry *table, const uint numCharacters, uint16_t* const keys, uint8_t* const keyLengths ) {
+    memset( keyLengths, 0, 256 );
+    for ( uint i = 0; i < numCharacters; ++i ) {
+        keys[table[i].character] = reverseKey( table[i].key, table[i].keyLength );
+        keyLengths[table[i].character] = table[i].keyLength;
+    }
 }
 
 /*
-* This assumes that the weights will not overflow, no check is done. It also
-* assumes that node1 and node2 are both non-NULL, passing a NULL value in
-* either would crash the program. It also directly modifies the values
-* within node1 and node2.
+* Puts the key of every input character into the writer. Three keys of at most
+* HUFFMAN_MAX_KEY_LENGTH bits fit between flushes. The writer needs room for
+* inputSize * HUFFMAN_MAX_KEY_LENGTH / 8 more bytes.
 */
-static Node combineAndResetNodes( PriorityNode* const node1, PriorityNode* const node2 ) {
-    Node newNode = ( Node ) { 
-                              .left = node1->address,
-                              .right = node2->address,
-                              .weight = node1->weight + node2->weight,
-                              .character = '\0'
-                            };
-    node1->weight = UINT_MAX;
-    node2->weight = UINT_MAX;
-    return newNode; 
+static void encodeCharacters( const uint8_t *input, const size_t inputSize, const uint16_t *keys, const uint8_t *keyLengths, BitWriter* const writer ) {
+    size_t i = 0;
+    for ( ; i + 3 <= inputSize; i += 3 ) {
+        bitWriter_put( writer, keys[input[i]], keyLengths[input[i]] );
+        bitWriter_put( writer, keys[input[i + 1]], keyLengths[input[i + 1]] );
+        bitWriter_put( writer, keys[input[i + 2]], keyLengths[input[i + 2]] );
+        bitWriter_flush( writer );
+    }
+    for ( ; i < inputSize; ++i ) {
+        bitWriter_put( writer, keys[input[i]], keyLengths[input[i]] );
+    }
+    bitWriter_flush( writer );
 }
 
-static int orderPriorityNodesAscending( const void *node1, const void *node2 ) {
-    const PriorityNode *n1 = ( PriorityNode * ) node1;
-    const PriorityNode *n2 = ( PriorityNode * ) node2;
-    return n1->weight <=  n2->weight ? -1 : 1;
+size_t huffman_encodeBound( const size_t inputSize ) {
+    return HUFFMAN_MAX_HEADER_SIZE + HUFFMAN_JUMP_TABLE_SIZE + ( inputSize * HUFFMAN_MAX_KEY_LENGTH + 7 ) / 8 + HUFFMAN_NUM_STREAMS + BITSTREAM_SLACK;
 }
 
-static void shiftPriorityNodeArrayDown( PriorityNode* const array, const uint arrayLength, const uint numShiftDown ) {
-    if ( arrayLength <= numShiftDown ) return;
-
-    if ( numShiftDown == 2 ) array[1] = ( PriorityNode ) { 
-                                                           .address =  NULL,
-                                                           .weight = UINT_MAX
-                                                         }; //deals with a situation where if it's a length of 3, and a shiftdown of 2, array[1] wouldn't be touched and would mess up future calcs
-    //shift the elements down the array
-    uint index = numShiftDown;
-    while ( arrayLength - index ) {
-        array[index - numShiftDown] = array[index]; 
-        ++index;
-    }
-    
-    //make the final moved elements have maxed out weight with no address to avoid
-    //moving them multiple times in future calls
-    for ( uint i = 0; i < numShiftDown; ++i ) {
-        array[arrayLength - 1 - i] = ( PriorityNode ) {
-                                                        .address = NULL,
-                                                        .weight = UINT_MAX
-                                                      };
-    }
+/*
+* Interleaved blocks split the input into HUFFMAN_NUM_STREAMS runs of
+* interleavedSegmentSize characters (the last one gets whatever is left) and
+* code each run into its own bit stream, so the decoder can follow all of them
+* at once. The jump table after the header holds the byte size of every
+* stream but the last.
+*/
+static size_t interleavedSegmentSize( const size_t size ) {
+    return ( size + HUFFMAN_NUM_STREAMS - 1 ) / HUFFMAN_NUM_STREAMS;
 }
 
-//ascending is referring to the literal ascii code for characters, thinking of
-//them as characters it could be said they're descending (A, B, C, ...)
-static int orderEncoderEntryAscendingByCharacter( const void *entry1, const void *entry2 ) {
-    const EncoderEntry *e1 = ( EncoderEntry * ) entry1;
-    const EncoderEntry *e2 = ( EncoderEntry * ) entry2;
-    return e1->character < e2->character ? -1 : 1;
+size_t huffman_encodeBuffer( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity, const uint maxKeyLength, const bool interleaved ) {
+    if ( !inputSize ) return 0;
+    uint32_t characterCounts[256];
+    histogram_count( input, inputSize, characterCounts );
+    return huffman_encodeBufferWithCounts( input, inputSize, characterCounts, output, outputCapacity, maxKeyLength, interleaved );
 }
-static int orderEncoderEntryAscendingByKeyLength( const void *entry1, const void *entry2 ) {
-    const EncoderEntry *e1 = ( EncoderEntry * ) entry1;
-    const EncoderEntry *e2 = ( EncoderEntry * ) entry2;
-    return e1->keyLength <= e2->keyLength ? -1 : 1;
+
+size_t huffman_encodeBufferWithCounts( const uint8_t *input, const size_t inputSize, const uint32_t *characterCounts, uint8_t *output, const size_t outputCapacity,
+                                       const uint maxKeyLength, bool interleaved ) {
+    if ( !inputSize ) return 0;
+
+    const uint64_t start = stats_now();
+    EncoderEntry encoderTable[256];
+    const uint numCharacters = buildEncoderTable( characterCounts, maxKeyLength, encoderTable );
+    if ( !numCharacters ) return 0;
+    uint16_t keys[256];
+    uint8_t keyLengths[256];
+    buildWriterKeys( encoderTable, numCharacters, keys, keyLengths );
+    stats_addTable( STATS_TABLE_HUFFMAN, start, encoderTable[numCharacters - 1].keyLength );
+
+    //the exact size is known up front, so running out of room is caught
+    //before anything is written
+    uint64_t totalBits = 0;
+    for ( uint i = 0; i < 256; ++i ) {
+        totalBits += ( uint64_t ) characterCounts[i] * keyLengths[i];
+    }
+    interleaved = interleaved && inputSize >= HUFFMAN_MIN_INTERLEAVED_SIZE;
+    const size_t headerSize = 1 + encoderTable[numCharacters - 1].keyLength + numCharacters;
+    const size_t numStreams = interleaved ? HUFFMAN_NUM_STREAMS : 1;
+    const size_t jumpTableSize = interleaved ? HUFFMAN_JUMP_TABLE_SIZE : 0;
+    //every stream can end on a partial byte
+    if ( headerSize + jumpTableSize + totalBits / 8 + numStreams + BITSTREAM_SLACK > outputCapacity ) return 0;
+
+    writeCanonicalHeader( encoderTable, numCharacters, interleaved, output );
+    if ( !interleaved ) {
+        BitWriter writer = bitWriter_create( output + headerSize, outputCapacity - headerSize );
+        encodeCharacters( input, inputSize, keys, keyLengths, &writer );
+        return headerSize + bitWriter_finish( &writer );
+    }
+
+    //each stream's writer may scribble into the slack past its end, which is
+    //where the next stream starts, so they have to be written in order
+    const size_t segmentSize = interleavedSegmentSize( inputSize );
+    size_t outputSize = headerSize + jumpTableSize;
+    for ( uint i = 0; i < HUFFMAN_NUM_STREAMS; ++i ) {
+        const size_t segmentStart = i * segmentSize;
+        const size_t segmentEnd = i + 1 < HUFFMAN_NUM_STREAMS ? segmentStart + segmentSize : inputSize;
+        BitWriter writer = bitWriter_create( output + outputSize, outputCapacity - outputSize );
+        encodeCharacters( input + segmentStart, segmentEnd - segmentStart, keys, keyLengths, &writer );
+        const size_t streamSize = bitWriter_finish( &writer );
+        if ( i + 1 < HUFFMAN_NUM_STREAMS ) writeLE32( output + headerSize + i * 4, streamSize );
+        outputSize += streamSize;
+    }
+    return outputSize;
 }
 
-void huffman_encode( const char *inputFileName, const char *outputFileName ) {
-    FILE *inputFile = fopen( inputFileName, "r" );
-    if ( !inputFile ) {
-        fprintf( stderr, "Could not open input file %s (huffman encode)\n", inputFileName );
-        fprintf( stderr, "Error number: %i\n", errno );
-        return;
-    }
-
-    uint characterCounts[256] = {0};
-    uint numUniqueCharacters = 0;
-    char currentCharacter = '\0'; //used to store the character from the input file
-    uint inputFileLength = 0;
-
-    //read the file one character at a time
-    while ( fread( &currentCharacter, 1, 1, inputFile ) ) {
-        numUniqueCharacters += ++characterCounts[currentCharacter] == 1;
-        inputFileLength++;
-    }
-
-    if ( !numUniqueCharacters ) { //empty file
-        fprintf( stderr, "%s has not contents, exiting\n", inputFileName );
-        return;
-    }
-
-    Node allNodes[numUniqueCharacters * 2 - 1]; //total nodes in the tree, is
-                                                //n (total number of characters)
-                                                //+ (n - 1) (number of combined
-                                                //nodes
-    PriorityNode queue1[numUniqueCharacters]; //initially holds all of the character leaves, only shrinks
-    PriorityNode queue2[numUniqueCharacters]; //initially empty, fills up with combination Nodes. Can grow and shrink, always gains the newest Node created
-
-    uint16_t allNodesIndex = 0; //has to be able to go up to 256 * 2 - 1 = 511, so uint16
-    uint8_t queue1Index = 0;
-    uint8_t queue2Index = 0; 
-
-    printf( "Number of unique characters: %u\n", numUniqueCharacters ); 
-    printf( "---Character Counts---\n" );
-    //iterate through all possible chars, not limiting to 127 now because I
-    //want this to be a generic algorithm, not just focused on alphabets.
-    //scoped to avoid i leaking out to other bits of code
-    {
-        uint8_t i = 0;
-        do {
-            if ( !characterCounts[i] ) continue;
-
-            printf( "%c: %i\n", i, characterCounts[i] );
-            allNodes[allNodesIndex] = ( Node ) { 
-                                                 .left = NULL,
-                                                 .right = NULL,
-                                                 .weight =characterCounts[i],
-                                                 .character =i
-                                               };
-            queue1[queue1Index] = ( PriorityNode ) { 
-                                                     .address = &allNodes[allNodesIndex++],
-                                                     .weight = characterCounts[i]
-                                                   };
-            queue2[queue1Index++] = ( PriorityNode ) { 
-                                                       .address = NULL,
-                                                       .weight =UINT_MAX
-                                                     };
-        } while ( i++ != 255 );
-    }
-
-    qsort( queue1, numUniqueCharacters, sizeof( PriorityNode ), orderPriorityNodesAscending ); 
-
-    //make the final tree
-    //grab the 2 nodes with the lowest weights
-    //combine them, add to the end of queue2, and remove the 2 nodes from their queues
-    //move elements forward in both queues based on how many were taken from it
-    {
-        uint8_t numStepsNeeded = numUniqueCharacters - 1;
-        while ( numStepsNeeded-- ) {
-            const bool queue1LT = queue1[0].weight < queue2[0].weight; 
-            bool queue2LT;
-            PriorityNode *p_node1 = queue1LT ? &queue1[0] : &queue2[0];
-            PriorityNode *p_node2;
-            if ( queue1LT ) {
-                queue2LT = queue2[0].weight < queue1[1].weight; 
-                p_node2 = queue2LT ? &queue2[0] : &queue1[1];
-            } else {
-                queue2LT = queue2[1].weight < queue1[0].weight;
-                p_node2 = queue2LT ?  &queue2[1] : &queue1[0];
-            }
-            const uint numTakenFromQueue1 = queue1LT + ( queue2LT == false ); //how many elements from q1 were taken
-            const uint numTakenFromQueue2 = 2 - numTakenFromQueue1; //how many elements from q2 were taken
-            queue2Index -= numTakenFromQueue2;
-
-            //create the new tree with the two lowest elements as its children
-            allNodes[allNodesIndex] = combineAndResetNodes( p_node1, p_node2 );
-            //shift both queues down by how many elements were taken from each
-            shiftPriorityNodeArrayDown( queue1, numUniqueCharacters, numTakenFromQueue1 );
-            shiftPriorityNodeArrayDown( queue2, numUniqueCharacters, numTakenFromQueue2 );
-            //after shifting q2, place the new element at the end of the queue
-            queue2[queue2Index++] = ( PriorityNode ) {
-                                                       .address = &allNodes[allNodesIndex],
-                                                       .weight = allNodes[allNodesIndex].weight
-                                                     };
-            ++allNodesIndex;
+/*
+* Reads the canonical header written by huffman_encodeBuffer (max key length, number
+* of keys at each length, then the characters in canonical order) and rebuilds
+* the keys the same way the encoder assigned them. interleaved is set from the
+* flag bit of the first byte.
+*
+* The count at the max key length can never really be 0, so a 0 there means
+* all 256 characters share that length (the uint8_t count wrapped around).
+*
+* Returns how many bytes of input the header took up, or 0 if it's malformed.
+*/
+static size_t readCanonicalHeader( const uint8_t *input, const size_t inputSize, EncoderEntry* const table, uint* const numCharacters, bool* const interleaved ) {
+    if ( inputSize < 1 ) return 0;
+    *interleaved = input[0] & HUFFMAN_INTERLEAVED_FLAG;
+    const uint8_t maxKeyLength = input[0] & ~HUFFMAN_INTERLEAVED_FLAG;
+    if ( !maxKeyLength || maxKeyLength > HUFFMAN_MAX_KEY_LENGTH || inputSize < 1u + maxKeyLength ) return 0;
+
+    uint numKeyLengths[HUFFMAN_MAX_KEY_LENGTH + 1] = {0};
+    uint total = 0;
+    for ( uint i = 1; i <= maxKeyLength; ++i ) {
+        numKeyLengths[i] = input[i];
+        total += numKeyLengths[i];
+    }
+    if ( !numKeyLengths[maxKeyLength] ) {
+        numKeyLengths[maxKeyLength] = 256;
+        total += 256;
+    }
+    if ( total > 256 || inputSize < 1u + maxKeyLength + total ) return 0;
+
+    const uint8_t *characters = input + 1 + maxKeyLength;
+    uint index = 0;
+    uint64_t key = 0;
+    for ( uint length = 1; length <= maxKeyLength; ++length ) {
+        for ( uint i = 0; i < numKeyLengths[length]; ++i ) {
+            if ( key >> length ) return 0; //oversubscribed, not a valid prefix code
+            table[index] = ( EncoderEntry ) {
+                                               .character = characters[index],
+                                               .key = key,
+                                               .keyLength = length
+                                             };
+            ++index;
+            ++key;
         }
+        key <<= 1;
     }
 
-    printTree( &allNodes[allNodesIndex - 1] );
+    *numCharacters = total;
+    return 1 + maxKeyLength + total;
+}
 
-    EncoderEntry encoderTable[numUniqueCharacters];
-    uint8_t encoderTransform[256] = {0}; //encoderTransform[ind] is the index of encoderTable that uses character 'ind'
-    uint8_t numKeyLength[256] = {0}; //track how many of each key length there are for encoding the tree
-    for ( int i = 0; i < numUniqueCharacters; ++i ) {
-        encoderTable[i] = ( EncoderEntry ) { 
-                                                    .character = i,
-                                                    .key = 0,
-                                                    .keyLength = 255
-                                                  };
-    }
-    setupEncoderTable( &allNodes[allNodesIndex - 1], encoderTable );
-    qsort( encoderTable, numUniqueCharacters, sizeof( EncoderEntry ), orderEncoderEntryAscendingByCharacter );
-    qsort( encoderTable, numUniqueCharacters, sizeof( EncoderEntry ), orderEncoderEntryAscendingByKeyLength );
+/*
+* Decode table entries are packed into 32 bits: the top 24 bits hold the
+* character (or the index of a subtable), the low 6 bits hold the number of
+* bits to consume (or the index width of the subtable), and bit 7 marks a link
+* to a subtable for keys longer than HUFFMAN_TABLE_BITS.
+*/
+#define DECODE_LINK 0x80u
+#define DECODE_LENGTH_MASK 0x3Fu
+#define PRIMARY_TABLE_SIZE ( 1u << HUFFMAN_TABLE_BITS )
 
-    for ( uint i = 0; i < numUniqueCharacters; ++i ) {
-        encoderTransform[encoderTable[i].character] = i;
-        numKeyLength[encoderTable[i].keyLength]++;
-    }
+static inline uint32_t makeDecodeEntry( const uint32_t value, const uint lengthOrBits, const bool isLink ) {
+    return value << 8 | ( isLink ? DECODE_LINK : 0 ) | lengthOrBits;
+}
 
-    printf( "Encoder Table (encode)\n" );
-    encoderTable[0].key = 0;
-    for ( uint i = 1; i < numUniqueCharacters; ++i ) {
-        encoderTable[i].key = ( encoderTable[i - 1].key + 1 ) << ( encoderTable[i].keyLength - encoderTable[i - 1].keyLength );
+/*
+* Builds the two level lookup table. Every key of length <= HUFFMAN_TABLE_BITS
+* fills all primary slots whose low bits match it. Longer keys share their
+* first HUFFMAN_TABLE_BITS bits with a primary slot that links to a subtable,
+* which is indexed by the remaining bits. Canonical keys with the same prefix
+* are next to each other in the table, so each subtable is built in one go.
+*
+* Returns the table (primary followed by subtables) allocated from arena, or NULL.
+*/
+static uint32_t *buildDecodeTable( const EncoderEntry *table, const uint numCharacters, Arena* const arena ) {
+    //first pass: size the subtables, one per distinct long prefix
+    size_t totalSize = PRIMARY_TABLE_SIZE;
+    for ( uint i = 0; i < numCharacters; ) {
+        if ( table[i].keyLength <= HUFFMAN_TABLE_BITS ) {
+            ++i;
+            continue;
+        }
+        const uint64_t prefix = table[i].key >> ( table[i].keyLength - HUFFMAN_TABLE_BITS );
+        uint maxLength = table[i].keyLength;
+        while ( i < numCharacters && table[i].key >> ( table[i].keyLength - HUFFMAN_TABLE_BITS ) == prefix ) {
+            maxLength = table[i++].keyLength;
+        }
+        totalSize += ( size_t ) 1 << ( maxLength - HUFFMAN_TABLE_BITS );
     }
 
-    for ( int i = 0; i < numUniqueCharacters; ++i ) {
-        printf( "%c: ", encoderTable[i].character );
-        printBinary( encoderTable[i].key, encoderTable[i].keyLength );
-        printf( "\n" );
-    }
+    uint32_t *entries = arena_calloc( arena, totalSize, sizeof( uint32_t ) );
+    if ( !entries ) return NULL;
 
-    char outputText[inputFileLength];
-    uint outputTextIndex = 0;
-    uint8_t bitOffset = 0;
-    char currentByte = '\0';
-    if ( fseek( inputFile, 0, SEEK_SET ) ) { //reset file to beginning
-        fprintf( stderr, "Could not reset file to beginning!" );
-        return;
-    }
+    size_t nextSubtable = PRIMARY_TABLE_SIZE;
+    for ( uint i = 0; i < numCharacters; ) {
+        const EncoderEntry entry = table[i];
+        if ( entry.keyLength <= HUFFMAN_TABLE_BITS ) {
+            const uint32_t value = makeDecodeEntry( ( uint8_t ) entry.character, entry.keyLength, false );
+            for ( uint32_t slot = reverseKey( entry.key, entry.keyLength ); slot < PRIMARY_TABLE_SIZE; slot += 1u << entry.keyLength ) {
+                entries[slot] = value;
+            }
+            ++i;
+            continue;
+        }
 
-    while ( fread( &currentCharacter, 1, 1, inputFile ) ) {
-        EncoderEntry entry = encoderTable[encoderTransform[currentCharacter]];
-        //printf( "%c: %u (%u)\n", character, entry.key, entry.keyLength );
-        for ( int j = 0; j < entry.keyLength; ++j ) {
-            if ( bitOffset > 7 ) { //end of buffer
-                outputText[outputTextIndex++] = currentByte;
-                currentByte = '\0';
-                bitOffset = 0;
+        const uint64_t prefix = entry.key >> ( entry.keyLength - HUFFMAN_TABLE_BITS );
+        uint groupEnd = i;
+        uint maxLength = entry.keyLength;
+        while ( groupEnd < numCharacters && table[groupEnd].key >> ( table[groupEnd].keyLength - HUFFMAN_TABLE_BITS ) == prefix ) {
+            maxLength = table[groupEnd++].keyLength;
+        }
+        const uint subBits = maxLength - HUFFMAN_TABLE_BITS;
+        entries[reverseKey( prefix, HUFFMAN_TABLE_BITS )] = makeDecodeEntry( nextSubtable, subBits, true );
+
+        for ( ; i < groupEnd; ++i ) {
+            const uint remaining = table[i].keyLength - HUFFMAN_TABLE_BITS;
+            const uint64_t suffix = table[i].key & ( ( ( uint64_t ) 1 << remaining ) - 1 );
+            const uint32_t value = makeDecodeEntry( ( uint8_t ) table[i].character, remaining, false );
+            for ( size_t slot = reverseKey( suffix, remaining ); slot < ( ( size_t ) 1 << subBits ); slot += ( size_t ) 1 << remaining ) {
+                entries[nextSubtable + slot] = value;
             }
-            currentByte |= ( ( entry.key >> ( entry.keyLength - j - 1 ) ) & 1 ) << bitOffset; //key bit shifted j times to the right (0 or 1), and shift that to the left bitOffset times
-            bitOffset++;
         }
+        nextSubtable += ( size_t ) 1 << subBits;
     }
-    outputText[outputTextIndex++] = currentByte;
-    FILE *outputFile = fopen( outputFileName, "wb" );
 
-    uint8_t maxKeyLength = encoderTable[numUniqueCharacters - 1].keyLength;
-    fwrite( &maxKeyLength, 1, 1, outputFile );
-    for ( uint i = 1; i < maxKeyLength + 1; ++i ) {
-        fwrite( &numKeyLength[i], 1, 1, outputFile ); //later update to only write the bits that are needed (1 for key length 1, 2 for 2, etc)
+    return entries;
+}
+
+/*
+* Resolves one character from the reader, which has to hold at least
+* HUFFMAN_MAX_KEY_LENGTH bits. Returns false on a bit pattern no key maps to.
+*/
+static inline bool decodeCharacter( const uint32_t *decodeTable, BitReader* const reader, uint8_t* const output ) {
+    uint32_t entry = decodeTable[bitReader_peek( reader, HUFFMAN_TABLE_BITS )];
+    if ( entry & DECODE_LINK ) {
+        bitReader_skip( reader, HUFFMAN_TABLE_BITS );
+        entry = decodeTable[( entry >> 8 ) + bitReader_peek( reader, entry & DECODE_LENGTH_MASK )];
     }
-    for ( uint i = 0; i < numUniqueCharacters; ++i ) {
-        fwrite( &encoderTable[i].character, 1, 1, outputFile );
+    const uint length = entry & DECODE_LENGTH_MASK;
+    *output = entry >> 8;
+    bitReader_skip( reader, length );
+    return length;
+}
+
+/*
+* Decodes outputSize characters from a single bit stream. After a refill there
+* are at least 56 bits and no key is longer than HUFFMAN_MAX_KEY_LENGTH (15),
+* so three characters can be decoded per refill.
+*/
+static bool decodeStream( const uint32_t *decodeTable, const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputSize ) {
+    BitReader reader = bitReader_create( input, inputSize );
+    size_t outputIndex = 0;
+    bool valid = true;
+    while ( valid && outputIndex + 3 <= outputSize ) {
+        bitReader_refill( &reader );
+        valid = decodeCharacter( decodeTable, &reader, &output[outputIndex] ) &&
+                decodeCharacter( decodeTable, &reader, &output[outputIndex + 1] ) &&
+                decodeCharacter( decodeTable, &reader, &output[outputIndex + 2] );
+        outputIndex += 3;
+    }
+    while ( valid && outputIndex < outputSize ) {
+        bitReader_refill( &reader );
+        valid = decodeCharacter( decodeTable, &reader, &output[outputIndex++] );
     }
+    //bits still sitting in the reader were loaded but never used
+    return valid && !bitReader_overrun( &reader );
+}
 
-    fwrite( outputText, 1, outputTextIndex, outputFile );
-    fclose( outputFile );
+/*
+* Splits an interleaved payload (jump table then the streams) into where each
+* stream's bits are and which part of the output they decode to. Returns false
+* if the jump table doesn't add up.
+*/
+static bool readJumpTable( const uint8_t *input, const size_t inputSize, const size_t outputSize,
+                           const uint8_t **streamInputs, size_t *streamInputSizes, size_t *streamOutputSizes ) {
+    if ( inputSize < HUFFMAN_JUMP_TABLE_SIZE || outputSize < HUFFMAN_MIN_INTERLEAVED_SIZE ) return false;
+    const size_t segmentSize = interleavedSegmentSize( outputSize );
+    size_t remaining = inputSize - HUFFMAN_JUMP_TABLE_SIZE;
+    const uint8_t *streamInput = input + HUFFMAN_JUMP_TABLE_SIZE;
+    for ( uint i = 0; i < HUFFMAN_NUM_STREAMS; ++i ) {
+        const size_t streamSize = i + 1 < HUFFMAN_NUM_STREAMS ? readLE32( input + i * 4 ) : remaining;
+        if ( streamSize > remaining ) return false;
+        streamInputs[i] = streamInput;
+        streamInputSizes[i] = streamSize;
+        streamOutputSizes[i] = i + 1 < HUFFMAN_NUM_STREAMS ? segmentSize : outputSize - segmentSize * i;
+        streamInput += streamSize;
+        remaining -= streamSize;
+    }
+    return true;
 }
 
-void huffman_decode( const char *inputFileName ) {
-    FILE *inputFile = fopen( inputFileName, "r" );
-    if ( !inputFile ) return;
-    
-    uint8_t maxKeyLength;
-    fread( &maxKeyLength, 1, 1, inputFile );
-    printf( "Max key length: %u\n", maxKeyLength );
-    uint8_t numKeyLengths[maxKeyLength]; //index 0 is length 1
-    uint8_t numUniqueCharacters = 0;
-    for ( uint i = 0; i < maxKeyLength; ++i ) {
-        fread( &numKeyLengths[i], 1, 1, inputFile );
-        numUniqueCharacters += numKeyLengths[i];
-        printf( "Keys @ length %u: %u\n", i + 1, numKeyLengths[i] );
-    }
-    printf( "Num unique characters: %u\n", numUniqueCharacters );
-    EncoderEntry encoderTable[numUniqueCharacters];
-    uint8_t currentKeyLength = 1;
-    while ( !numKeyLengths[currentKeyLength - 1] ) currentKeyLength++;
-    uint8_t runningTotal = numKeyLengths[currentKeyLength - 1];
-    for ( uint i = 0; i < numUniqueCharacters; ++i ) {
-        fread( &encoderTable[i].character, 1, 1, inputFile );
-        while ( i >= runningTotal ) {
-            runningTotal += numKeyLengths[++currentKeyLength - 1];
-        }
-        encoderTable[i].keyLength = currentKeyLength;
-        if ( i == 0 ) {
-            encoderTable[0].key = 0;
-            continue;
+//decodes the characters a stream has left once the others can't keep up
+static bool finishStream( const uint32_t *decodeTable, BitReader reader, uint8_t *output, const size_t outputSize ) {
+    for ( size_t i = 0; i < outputSize; ++i ) {
+        bitReader_refill( &reader );
+        if ( !decodeCharacter( decodeTable, &reader, &output[i] ) ) return false;
+    }
+    return !bitReader_overrun( &reader );
+}
+
+/*
+* Runs HUFFMAN_NUM_STREAMS readers side by side. Each step refills all of them
+* and pulls three characters from each, the lookups of different streams don't
+* depend on each other so the CPU can overlap them. The last stream is never
+* longer than the others, so once it runs low the rest finish one at a time.
+*/
+static bool decodeInterleaved( const uint32_t *decodeTable, const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputSize ) {
+    const uint8_t *streamInputs[HUFFMAN_NUM_STREAMS];
+    size_t streamInputSizes[HUFFMAN_NUM_STREAMS];
+    size_t streamOutputSizes[HUFFMAN_NUM_STREAMS];
+    if ( !readJumpTable( input, inputSize, outputSize, streamInputs, streamInputSizes, streamOutputSizes ) ) return false;
+
+    const size_t segmentSize = streamOutputSizes[0];
+    BitReader r0 = bitReader_create( streamInputs[0], streamInputSizes[0] );
+    BitReader r1 = bitReader_create( streamInputs[1], streamInputSizes[1] );
+    BitReader r2 = bitReader_create( streamInputs[2], streamInputSizes[2] );
+    BitReader r3 = bitReader_create( streamInputs[3], streamInputSizes[3] );
+    uint8_t *o0 = output;
+    uint8_t *o1 = output + segmentSize;
+    uint8_t *o2 = output + segmentSize * 2;
+    uint8_t *o3 = output + segmentSize * 3;
+
+    const size_t lastSize = streamOutputSizes[HUFFMAN_NUM_STREAMS - 1];
+    size_t i = 0;
+    bool valid = true;
+    for ( ; valid && i + 3 <= lastSize; i += 3 ) {
+        bitReader_refill( &r0 );
+        bitReader_refill( &r1 );
+        bitReader_refill( &r2 );
+        bitReader_refill( &r3 );
+        for ( uint j = 0; j < 3; ++j ) {
+            valid &= decodeCharacter( decodeTable, &r0, &o0[i + j] );
+            valid &= decodeCharacter( decodeTable, &r1, &o1[i + j] );
+            valid &= decodeCharacter( decodeTable, &r2, &o2[i + j] );
+            valid &= decodeCharacter( decodeTable, &r3, &o3[i + j] );
         }
+    }
+    if ( !valid ) return false;
+
+    //by value so the readers above can stay in registers
+    return finishStream( decodeTable, r0, o0 + i, streamOutputSizes[0] - i ) &&
+           finishStream( decodeTable, r1, o1 + i, streamOutputSizes[1] - i ) &&
+           finishStream( decodeTable, r2, o2 + i, streamOutputSizes[2] - i ) &&
+           finishStream( decodeTable, r3, o3 + i, streamOutputSizes[3] - i );
+}
 
-        encoderTable[i].key = ( encoderTable[i - 1].key + 1 ) << ( encoderTable[i].keyLength - encoderTable[i - 1].keyLength );
+size_t huffman_decodeBuffer( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputSize, Arena* const arena ) {
+    const uint64_t start = stats_now();
+    EncoderEntry encoderTable[256];
+    uint numCharacters = 0;
+    bool interleaved;
+    const size_t headerSize = readCanonicalHeader( input, inputSize, encoderTable, &numCharacters, &interleaved );
+    if ( !headerSize ) {
+        fprintf( stderr, "Malformed header (huffman decode)\n" );
+        return 0;
     }
 
-    printf( "Encoder Table (decode)\n" );
-    for ( int i = 0; i < numUniqueCharacters; ++i ) {
-        printf( "%c: ", encoderTable[i].character );
-        printBinary( encoderTable[i].key, encoderTable[i].keyLength );
-        printf( "\n" );
+    const size_t mark = arena_mark( arena );
+    uint32_t *decodeTable = buildDecodeTable( encoderTable, numCharacters, arena );
+    if ( !decodeTable ) {
+        fprintf( stderr, "Cannot allocate decode table (huffman decode)\n" );
+        return 0;
     }
+    stats_addTable( STATS_TABLE_HUFFMAN, start, encoderTable[numCharacters - 1].keyLength );
 
-    Node allNodes[numUniqueCharacters * 2 - 1];
-    uint allNodesIndex = 1;
+    const bool valid = interleaved ?
+                       decodeInterleaved( decodeTable, input + headerSize, inputSize - headerSize, output, outputSize ) :
+                       decodeStream( decodeTable, input + headerSize, inputSize - headerSize, output, outputSize );
+    arena_release( arena, mark );
 
-    for ( uint i = 0; i < numUniqueCharacters * 2 - 1; ++i ) {
-        allNodes[i] = ( Node ) { NULL, NULL, 0, '\0' };
+    if ( !valid ) {
+        fprintf( stderr, "Corrupt or truncated input (huffman decode)\n" );
+        return 0;
     }
-    
-    //setup tree
-    for ( uint i = 0; i < numUniqueCharacters; ++i ) {
-        Node *currentNodeAddress = &allNodes[0];
-        for ( uint j = 0; j < encoderTable[i].keyLength; ++j ) {
-            bool nextIsRight = encoderTable[i].key >> ( encoderTable[i].keyLength - j - 1 ) & 1;
-            Node *nextNodeAddress = nextIsRight ? currentNodeAddress->right :
-                                           currentNodeAddress->left;
-            if ( !nextNodeAddress ) {
-                nextNodeAddress = &allNodes[allNodesIndex++]; //set it to the next available node (is all NULLs at this point
-            }
-
-            if ( nextIsRight ) {
-                currentNodeAddress->right = nextNodeAddress;
-            } else {
-                currentNodeAddress->left = nextNodeAddress;
-            }
+    return outputSize;
+}
 
-            currentNodeAddress = nextNodeAddress;
+bool huffman_buildCode( const uint8_t *keyLengths, HuffmanCode* const code ) {
+    //Kraft sum in units of the shortest possible slot
+    uint32_t used = 0;
+    for ( uint i = 0; i < 256; ++i ) {
+        if ( !keyLengths[i] || keyLengths[i] > HUFFMAN_TABLE_BITS ) return false;
+        used += PRIMARY_TABLE_SIZE >> keyLengths[i];
+    }
+    if ( used > PRIMARY_TABLE_SIZE ) return false;
+
+    memcpy( code->keyLengths, keyLengths, 256 );
+    huffman_buildCanonicalKeys( keyLengths, 256, code->keys );
+    //slots no key reaches (an incomplete code) stay 0, which decodes as an error
+    memset( code->decodeTable, 0, sizeof( code->decodeTable ) );
+    for ( uint i = 0; i < 256; ++i ) {
+        const uint32_t value = makeDecodeEntry( i, keyLengths[i], false );
+        for ( uint32_t slot = code->keys[i]; slot < PRIMARY_TABLE_SIZE; slot += 1u << keyLengths[i] ) {
+            code->decodeTable[slot] = value;
         }
-        currentNodeAddress->character = encoderTable[i].character;
     }
+    return true;
+}
 
-    char currentByte; 
-    Node *currentNode = &allNodes[0];
-    while ( fread( &currentByte, 1, 1, inputFile ) ) {
-       for ( uint i = 0; i < 8; ++i ) {
-            if ( !currentNode ) {
-                break;
-            }
-            if ( currentNode->character ) {
-                printf( "%c", currentNode->character );
-                currentNode = &allNodes[0];
-            }
+size_t huffman_encodeWithCodeBound( const size_t inputSize ) {
+    return ( inputSize * HUFFMAN_TABLE_BITS + 7 ) / 8 + BITSTREAM_SLACK;
+}
 
-            bool moveRight = currentByte >> i & 1;
-            currentNode = moveRight ? currentNode->right : currentNode->left;
-        }
+size_t huffman_encodeWithCode( const HuffmanCode* const code, const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity ) {
+    if ( !inputSize ) return 0;
+    //a single pass when there is room for the worst case, otherwise the exact
+    //size is worked out first like huffman_encodeBuffer does
+    if ( outputCapacity < huffman_encodeWithCodeBound( inputSize ) ) {
+        uint64_t totalBits = 0;
+        for ( size_t i = 0; i < inputSize; ++i ) totalBits += code->keyLengths[input[i]];
+        if ( ( totalBits + 7 ) / 8 + BITSTREAM_SLACK > outputCapacity ) return 0;
     }
+
+    BitWriter writer = bitWriter_create( output, outputCapacity );
+    encodeCharacters( input, inputSize, code->keys, code->keyLengths, &writer );
+    return bitWriter_finish( &writer );
+}
+
+size_t huffman_decodeWithCode( const HuffmanCode* const code, const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputSize ) {
+    return decodeStream( code->decodeTable, input, inputSize, output, outputSize ) ? outputSize : 0;
 }
@@ -2,8 +2,102 @@
 #define HUFFMAN_H
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "arena.h"
 
-void huffman_encode( const char *inputFileName, const char *outputFileName );
-void huffman_decode( const char *inputFileName );
+//number of bits resolved by the first decode table lookup, longer keys take
+//a second lookup into a subtable
+#define HUFFMAN_TABLE_BITS 11
+//hard limit on key length, keeps every key (and several in a row) inside a
+//64 bit register for both the encoder and the decoder
+#define HUFFMAN_MAX_KEY_LENGTH 15
+//limit Huffman stages use unless told otherwise, at or under HUFFMAN_TABLE_BITS every
+//character decodes with a single table lookup
+#ifndef HUFFMAN_DEFAULT_MAX_KEY_LENGTH
+#define HUFFMAN_DEFAULT_MAX_KEY_LENGTH 11
+#endif
+//largest alphabet huffman_buildKeyLengths can handle
+#define HUFFMAN_MAX_SYMBOLS 288
+//largest canonical header: max key length, a count per length, 256 characters
+#define HUFFMAN_MAX_HEADER_SIZE ( 1 + HUFFMAN_MAX_KEY_LENGTH + 256 )
+//set in the max key length byte of the header when the block is interleaved
+#define HUFFMAN_INTERLEAVED_FLAG 0x80
+//interleaved blocks hold this many independent bit streams, after the header
+//a jump table gives the byte size of all but the last
+#define HUFFMAN_NUM_STREAMS 4
+#define HUFFMAN_JUMP_TABLE_SIZE ( ( HUFFMAN_NUM_STREAMS - 1 ) * 4 )
+//below this the jump table costs more than interleaving gains
+#define HUFFMAN_MIN_INTERLEAVED_SIZE 1024
+
+/*
+* Computes optimal key lengths for symbols 0..numSymbols - 1 with none longer
+* than maxKeyLength (package-merge). Symbols with a count of 0 get length 0,
+* a single used symbol gets length 1. Returns false if maxKeyLength is out of
+* range or too short to fit every used symbol.
+*/
+bool huffman_buildKeyLengths( const uint32_t *counts, uint numSymbols, uint maxKeyLength, uint8_t *keyLengths );
+
+/*
+* Canonical keys for the given key lengths (shortest first, then by symbol,
+* the same order as the block headers and DEFLATE), already reversed so they
+* can be put into a BitWriter as is. Symbols with length 0 get no key.
+*/
+void huffman_buildCanonicalKeys( const uint8_t *keyLengths, uint numSymbols, uint16_t *keys );
+
+//output capacity that huffman_encodeBuffer can never run out of
+size_t huffman_encodeBound( size_t inputSize );
+
+/*
+* Writes the canonical header (max key length, number of keys at each length,
+* the characters in canonical order) followed by the packed keys of every
+* input character, with keys limited to maxKeyLength bits. If interleaved is
+* set (and the input is at least HUFFMAN_MIN_INTERLEAVED_SIZE) the keys are
+* split into HUFFMAN_NUM_STREAMS streams that decode in parallel. output needs
+* BITSTREAM_SLACK bytes past what is actually written. Returns bytes written,
+* or 0 if inputSize is 0 or the result would not fit in outputCapacity.
+*/
+size_t huffman_encodeBuffer( const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputCapacity, uint maxKeyLength, bool interleaved );
+
+//same, for callers that already have the histogram of input (see histogram_count)
+size_t huffman_encodeBufferWithCounts( const uint8_t *input, size_t inputSize, const uint32_t *characterCounts, uint8_t *output, size_t outputCapacity,
+                                       uint maxKeyLength, bool interleaved );
+
+/*
+* Decodes exactly outputSize characters from input (canonical header followed
+* by the packed keys) into output. The decode table is built in arena and
+* given back before returning. Returns outputSize on success, 0 if the input
+* is malformed or runs out early.
+*/
+size_t huffman_decodeBuffer( const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputSize, Arena *arena );
+
+/*
+* A fixed code over all 256 characters, for coding without a header when
+* both sides already have the code (see dictionary.h). Keys are at most
+* HUFFMAN_TABLE_BITS long so every character decodes with a single lookup.
+* Nothing changes once built, so threads can share one.
+*/
+typedef struct HuffmanCode {
+    uint8_t keyLengths[256];
+    uint16_t keys[256]; //reversed, ready for a BitWriter
+    uint32_t decodeTable[1 << HUFFMAN_TABLE_BITS];
+} HuffmanCode;
+
+/*
+* Fills code from the key length of every character. False if a character
+* has no key, a key is longer than HUFFMAN_TABLE_BITS or the lengths don't
+* make a prefix code.
+*/
+bool huffman_buildCode( const uint8_t *keyLengths, HuffmanCode *code );
+
+//output capacity huffman_encodeWithCode can never run out of
+size_t huffman_encodeWithCodeBound( size_t inputSize );
+
+//just the packed keys, returns bytes written or 0 if inputSize is 0 or it
+//wouldn't fit (output needs BITSTREAM_SLACK bytes past the end as usual)
+size_t huffman_encodeWithCode( const HuffmanCode *code, const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputCapacity );
+
+//decodes exactly outputSize characters, returns outputSize or 0 on malformed input
+size_t huffman_decodeWithCode( const HuffmanCode *code, const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputSize );
 
 #endif
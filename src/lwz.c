@@ -1,3 +1,187 @@
 #include "lwz.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "bitstream.h"
+
+#define FIRST_FREE_CODE 257
+
+/*
+* The encoder's dictionary maps (prefix code, next byte) to a code. Instead of
+* a node per entry it is a flat open addressing table at most half full, with
+* the key and code next to each other, so a lookup is usually one cache line.
+*/
+typedef struct DictionaryEntry {
+    uint32_t key; //prefix << 8 | byte, plus 1 so 0 means empty
+    uint32_t code;
+} DictionaryEntry;
+
+//number of bits needed to write every code up to and including maxCode
+static inline uint codeWidth( const uint32_t maxCode ) {
+    return 32 - __builtin_clz( maxCode | 1 );
+}
+
+static inline uint32_t hashKey( const uint32_t key, const uint32_t mask ) {
+    return ( key * 2654435761u ) >> 7 & mask;
+}
+
+size_t lwz_compressBound( const size_t inputSize ) {
+    //every byte can end up as its own code, plus a clear code per dictionary
+    return 1 + ( ( inputSize + inputSize / 256 + 2 ) * LWZ_MAX_CODE_BITS + 7 ) / 8 + BITSTREAM_SLACK;
+}
+
+//the coded block, 0 if it doesn't fit in outputCapacity or the dictionary can't be allocated
+static size_t encodeCodes( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity, const uint maxCodeBits,
+                           Arena* const arena ) {
+    if ( outputCapacity < 1 + BITSTREAM_SLACK ) return 0;
+
+    const uint32_t maxCodes = 1u << maxCodeBits;
+    const uint32_t tableMask = ( maxCodes << 1 ) - 1;
+    const size_t mark = arena_mark( arena );
+    DictionaryEntry *table = arena_calloc( arena, tableMask + 1, sizeof( DictionaryEntry ) );
+    if ( !table ) {
+        fprintf( stderr, "Cannot allocate dictionary (lwz compress)\n" );
+        return 0;
+    }
+
+    output[0] = maxCodeBits;
+    BitWriter writer = bitWriter_create( output + 1, outputCapacity - 1 );
+    uint32_t nextCode = FIRST_FREE_CODE;
+    uint32_t prefix = input[0];
+    bool fits = true;
+
+    for ( size_t i = 1; i <= inputSize && fits; ++i ) {
+        //one code goes out per step at most, so one flush per step keeps
+        //the writer from ever holding more than 7 + LWZ_MAX_CODE_BITS bits
+        if ( bitWriter_available( &writer ) < 8 ) {
+            fits = false;
+            break;
+        }
+        if ( i == inputSize ) {
+            bitWriter_put( &writer, prefix, codeWidth( nextCode - 1 ) );
+            break;
+        }
+
+        const uint32_t key = ( prefix << 8 | input[i] ) + 1;
+        uint32_t slot = hashKey( key, tableMask );
+        while ( table[slot].key && table[slot].key != key ) slot = ( slot + 1 ) & tableMask;
+        if ( table[slot].key ) {
+            prefix = table[slot].code;
+            continue;
+        }
+
+        const uint width = codeWidth( nextCode - 1 );
+        bitWriter_put( &writer, prefix, width );
+        if ( nextCode < maxCodes ) {
+            table[slot] = ( DictionaryEntry ) { .key = key, .code = nextCode++ };
+        } else {
+            bitWriter_flush( &writer );
+            bitWriter_put( &writer, LWZ_CLEAR_CODE, width );
+            memset( table, 0, ( tableMask + 1 ) * sizeof( DictionaryEntry ) );
+            nextCode = FIRST_FREE_CODE;
+        }
+        bitWriter_flush( &writer );
+        prefix = input[i];
+    }
+
+    arena_release( arena, mark );
+    if ( !fits ) return 0;
+    return 1 + bitWriter_finish( &writer );
+}
+
+size_t lwz_compressBlock( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity, const uint maxCodeBits,
+                          Arena* const arena ) {
+    if ( !inputSize || maxCodeBits < LWZ_MIN_CODE_BITS || maxCodeBits > LWZ_MAX_CODE_BITS ) return 0;
+    //the codes only get the room to beat storing, so data that doesn't
+    //shrink gives up as soon as it runs out instead of coding to the end
+    const size_t codedCapacity = inputSize + BITSTREAM_SLACK < outputCapacity ? inputSize + BITSTREAM_SLACK : outputCapacity;
+    const size_t codedSize = encodeCodes( input, inputSize, output, codedCapacity, maxCodeBits, arena );
+    if ( codedSize && codedSize <= inputSize ) return codedSize;
+    if ( 1 + inputSize > outputCapacity ) return 0;
+    output[0] = LWZ_STORED;
+    memcpy( output + 1, input, inputSize );
+    return 1 + inputSize;
+}
+
+/*
+* The decoder keeps, per code, the code it extends, its last byte and its
+* length. Knowing the length up front lets a code's string be written straight
+* into the output from its last byte back to its first.
+*/
+size_t lwz_decompressBlock( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputSize, Arena* const arena ) {
+    if ( !inputSize ) return 0;
+    if ( input[0] == LWZ_STORED ) {
+        if ( inputSize - 1 != outputSize ) {
+            fprintf( stderr, "Corrupt block (lwz decompress)\n" );
+            return 0;
+        }
+        memcpy( output, input + 1, outputSize );
+        return outputSize;
+    }
+    const uint maxCodeBits = input[0];
+    if ( maxCodeBits < LWZ_MIN_CODE_BITS || maxCodeBits > LWZ_MAX_CODE_BITS ) return 0;
+    const uint32_t maxCodes = 1u << maxCodeBits;
+
+    const size_t mark = arena_mark( arena );
+    uint32_t *prefixes = arena_alloc( arena, maxCodes * sizeof( uint32_t ) );
+    uint32_t *lengths = arena_alloc( arena, maxCodes * sizeof( uint32_t ) );
+    uint8_t *suffixes = arena_alloc( arena, maxCodes );
+    size_t result = 0;
+    if ( !prefixes || !lengths || !suffixes ) goto cleanup;
+    for ( uint32_t i = 0; i < 256; ++i ) {
+        suffixes[i] = i;
+        lengths[i] = 1;
+    }
+
+    BitReader reader = bitReader_create( input + 1, inputSize - 1 );
+    uint32_t nextCode = FIRST_FREE_CODE;
+    bool havePrevious = false;
+    uint32_t previous = 0;
+    size_t outputIndex = 0;
+    while ( outputIndex < outputSize ) {
+        bitReader_refill( &reader );
+        //the encoder is one entry ahead, so the code just past the last known
+        //one can show up too (the string that starts and ends with the same byte)
+        uint32_t maxCode = nextCode - 1 + havePrevious;
+        if ( maxCode > maxCodes - 1 ) maxCode = maxCodes - 1;
+        const uint32_t code = bitReader_get( &reader, codeWidth( maxCode ) );
+
+        if ( code == LWZ_CLEAR_CODE ) {
+            nextCode = FIRST_FREE_CODE;
+            havePrevious = false;
+            continue;
+        }
+        if ( code > maxCode || ( code == nextCode && !havePrevious ) ) goto cleanup;
+
+        //the new entry is the previous string plus the first byte of this one,
+        //which for code == nextCode is the first byte of the previous string
+        const size_t length = code == nextCode ? lengths[previous] + 1 : lengths[code];
+        if ( length > outputSize - outputIndex ) goto cleanup;
+        uint8_t *stringEnd = output + outputIndex + length - 1;
+        uint32_t walk = code == nextCode ? previous : code;
+        uint8_t *cursor = code == nextCode ? stringEnd - 1 : stringEnd;
+        while ( walk >= FIRST_FREE_CODE ) {
+            *cursor-- = suffixes[walk];
+            walk = prefixes[walk];
+        }
+        *cursor = walk;
+        if ( code == nextCode ) *stringEnd = walk;
+
+        if ( havePrevious && nextCode < maxCodes ) {
+            prefixes[nextCode] = previous;
+            suffixes[nextCode] = walk;
+            lengths[nextCode] = lengths[previous] + 1;
+            ++nextCode;
+        }
+        previous = code;
+        havePrevious = true;
+        outputIndex += length;
+    }
+    if ( !bitReader_overrun( &reader ) ) result = outputSize;
+
+cleanup:
+    arena_release( arena, mark );
+    if ( !result ) fprintf( stderr, "Corrupt block (lwz decompress)\n" );
+    return result;
+}
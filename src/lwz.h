@@ -1,4 +1,34 @@
 #ifndef LWZ_H
 #define LWZ_H
+#include <stdint.h>
+#include <stdlib.h>
+#include "arena.h"
+
+/*
+* LZW with variable width codes. Codes start at 9 bits and grow one bit each
+* time the dictionary outgrows the current width, up to maxCodeBits. Once the
+* dictionary is full the encoder sends LWZ_CLEAR_CODE and both sides start
+* over with just the 256 single byte entries.
+*
+* A block is one byte holding maxCodeBits followed by the packed codes. There
+* is no end code, the decoder stops when the output is full. Blocks the codes
+* wouldn't make smaller are stored instead: a 0 byte (LWZ_STORED) and the
+* bytes as they are.
+*/
+#define LWZ_MIN_CODE_BITS 9
+#define LWZ_MAX_CODE_BITS 20
+#define LWZ_DEFAULT_CODE_BITS 16
+#define LWZ_CLEAR_CODE 256
+#define LWZ_STORED 0
+
+//output capacity lwz_compressBlock can never run out of
+size_t lwz_compressBound( size_t inputSize );
+
+//returns bytes written, 0 on a bad maxCodeBits, empty input, or not enough room;
+//the dictionary is allocated from arena
+size_t lwz_compressBlock( const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputCapacity, uint maxCodeBits, Arena *arena );
+
+//decodes exactly outputSize bytes, returns outputSize or 0 on malformed input
+size_t lwz_decompressBlock( const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputSize, Arena *arena );
 
 #endif
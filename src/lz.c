@@ -1,3 +1,483 @@
 #include "lz.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "huffman.h"
+#include "rans.h"
+#include "histogram.h"
+#include "bitstream.h"
+
+#define NUM_STREAMS 3
+//per stream: mode byte, raw size, coded size
+#define STREAM_HEADER_SIZE 9
+#define STREAM_RAW 0
+#define STREAM_HUFFMAN 1
+#define STREAM_RANS 2
+#define HASH_LOG 16
+//a match this close to the end could read past it when comparing 8 bytes
+#define MATCH_END_MARGIN 8
+//streams shorter than this aren't worth a Huffman or rANS header
+#define MIN_CODED_STREAM_SIZE 64
+
+/*
+* How hard each level looks: how many chain links to follow, how many later
+* positions to try before taking a match (lazy matching), and a match length
+* that is good enough to stop searching.
+*/
+typedef struct LevelParams {
+    uint chainDepth;
+    uint lazyDepth;
+    uint niceLength;
+} LevelParams;
+
+static const LevelParams levelParams[LZ_MAX_LEVEL + 1] = {
+    [1] = { 1, 0, 16 },
+    [2] = { 2, 0, 32 },
+    [3] = { 4, 0, 32 },
+    [4] = { 8, 1, 64 },
+    [5] = { 16, 1, 128 },
+    [6] = { 32, 1, 128 },
+    [7] = { 64, 2, 256 },
+    [8] = { 256, 2, 1024 },
+    [9] = { 1024, 2, 65536 },
+};
+
+//sequences being collected before they are Huffman coded
+typedef struct SequenceStreams {
+    uint8_t *literals;
+    size_t numLiterals;
+    uint8_t *tokens;
+    size_t numTokens;
+    uint8_t *offsets;
+    size_t numOffsets;
+} SequenceStreams;
+
+typedef struct MatchFinder {
+    const uint8_t *input;
+    size_t inputSize;
+    uint32_t *head;  //most recent position for each hash, UINT32_MAX if none
+    uint32_t *chain; //previous position with the same hash, by position & windowMask
+    uint32_t windowMask;
+    uint32_t windowSize;
+    uint32_t maxLength;
+    LevelParams level;
+} MatchFinder;
+
+typedef struct Match {
+    uint32_t length;
+    uint32_t distance;
+} Match;
+
+static inline uint32_t read32( const uint8_t *input ) {
+    uint32_t value;
+    memcpy( &value, input, 4 );
+    return value;
+}
+
+static inline uint32_t hashPosition( const uint8_t *input ) {
+    return ( read32( input ) * 2654435761u ) >> ( 32 - HASH_LOG );
+}
+
+//length of the common prefix of a and b, b ahead of a, not going past limit
+static inline uint32_t matchLength( const uint8_t *a, const uint8_t *b, const uint8_t *limit ) {
+    const uint8_t *start = b;
+    while ( b + 8 <= limit ) {
+        uint64_t wordA, wordB;
+        memcpy( &wordA, a, 8 );
+        memcpy( &wordB, b, 8 );
+        const uint64_t difference = wordA ^ wordB;
+        if ( difference ) return b - start + ( __builtin_ctzll( difference ) >> 3 );
+        a += 8;
+        b += 8;
+    }
+    while ( b < limit && *a == *b ) {
+        ++a;
+        ++b;
+    }
+    return b - start;
+}
+
+//matches stop short of the end (see MATCH_END_MARGIN) and at maxLength
+static inline const uint8_t *matchLimit( const MatchFinder* const finder, const uint32_t position ) {
+    const size_t remaining = finder->inputSize - MATCH_END_MARGIN - position;
+    return finder->input + position + ( remaining < finder->maxLength ? remaining : finder->maxLength );
+}
+
+static inline void insertPosition( MatchFinder* const finder, const uint32_t position ) {
+    const uint32_t hash = hashPosition( finder->input + position );
+    finder->chain[position & finder->windowMask] = finder->head[hash];
+    finder->head[hash] = position;
+}
+
+/*
+* Walks the chain of earlier positions with the same hash (newest first) and
+* returns the longest match, inserting position into the chain as it goes.
+*/
+static Match findMatch( MatchFinder* const finder, const uint32_t position ) {
+    const uint8_t *current = finder->input + position;
+    const uint8_t *limit = matchLimit( finder, position );
+    const uint32_t hash = hashPosition( current );
+    uint32_t candidate = finder->head[hash];
+    finder->chain[position & finder->windowMask] = candidate;
+    finder->head[hash] = position;
+
+    Match best = { 0, 0 };
+    for ( uint depth = finder->level.chainDepth; depth && candidate != UINT32_MAX; --depth ) {
+        const uint32_t distance = position - candidate;
+        if ( distance >= finder->windowSize ) break;
+        //cheap reject: the byte that would make this match the longest so far
+        if ( finder->input[candidate + best.length] == current[best.length] ) {
+            const uint32_t length = matchLength( finder->input + candidate, current, limit );
+            if ( length > best.length ) {
+                best = ( Match ) { .length = length, .distance = distance };
+                if ( length >= finder->level.niceLength ) break;
+            }
+        }
+        candidate = finder->chain[candidate & finder->windowMask];
+    }
+    if ( best.length < LZ_MIN_MATCH ) best.length = 0;
+    return best;
+}
+
+/*
+* Level 1 keeps no chains, just the latest position per hash, so it only
+* touches the small head table for every position.
+*/
+static inline Match findMatchFast( MatchFinder* const finder, const uint32_t position ) {
+    const uint8_t *current = finder->input + position;
+    const uint32_t hash = hashPosition( current );
+    const uint32_t candidate = finder->head[hash];
+    finder->head[hash] = position;
+
+    const uint32_t distance = position - candidate;
+    if ( candidate == UINT32_MAX || distance >= finder->windowSize || read32( finder->input + candidate ) != read32( current ) ) {
+        return ( Match ) { 0, 0 };
+    }
+    const uint8_t *limit = matchLimit( finder, position );
+    return ( Match ) { .length = LZ_MIN_MATCH + matchLength( finder->input + candidate + LZ_MIN_MATCH, current + LZ_MIN_MATCH, limit ), .distance = distance };
+}
+
+//lengths of 15 or more spill into extra bytes of up to 255 each
+static inline void putExtraLength( SequenceStreams* const streams, size_t value ) {
+    while ( value >= 255 ) {
+        streams->tokens[streams->numTokens++] = 255;
+        value -= 255;
+    }
+    streams->tokens[streams->numTokens++] = value;
+}
+
+static void putSequence( void *context, const uint8_t *literals, const size_t numLiterals, const uint32_t matchLength, uint32_t distance ) {
+    SequenceStreams* const streams = context;
+    const size_t lengthCode = matchLength ? matchLength - LZ_MIN_MATCH : 0;
+    streams->tokens[streams->numTokens++] = ( numLiterals < 15 ? numLiterals : 15 ) << 4 | ( lengthCode < 15 ? lengthCode : 15 );
+    if ( numLiterals >= 15 ) putExtraLength( streams, numLiterals - 15 );
+    if ( lengthCode >= 15 ) putExtraLength( streams, lengthCode - 15 );
+
+    memcpy( streams->literals + streams->numLiterals, literals, numLiterals );
+    streams->numLiterals += numLiterals;
+
+    if ( !matchLength ) return;
+    while ( distance >= 0x80 ) {
+        streams->offsets[streams->numOffsets++] = ( distance & 0x7F ) | 0x80;
+        distance >>= 7;
+    }
+    streams->offsets[streams->numOffsets++] = distance;
+}
+
+/*
+* Greedy parse with optional lazy matching: before committing to a match, the
+* next lazyDepth positions get a look too, and a longer match there wins over
+* the current one (which turns into a literal). Level 1 skips the chains,
+* only remembers the end of each match and steps faster through data that
+* doesn't match, trading ratio for speed.
+*/
+static void parseSequences( MatchFinder* const finder, LzSequenceSink *sink, void *context ) {
+    const uint8_t *input = finder->input;
+    const uint32_t end = finder->inputSize;
+    const uint32_t matchEnd = end > MATCH_END_MARGIN + LZ_MIN_MATCH ? end - MATCH_END_MARGIN - LZ_MIN_MATCH : 0;
+    const bool fast = finder->level.chainDepth == 1;
+    uint32_t anchor = 0; //start of the literals not yet written
+    uint32_t position = 0;
+    uint32_t nextInsert = 0; //positions below this are already in the chains
+
+    while ( position < matchEnd ) {
+        Match match = fast ? findMatchFast( finder, position ) : findMatch( finder, position );
+        nextInsert = position + 1;
+        if ( !match.length ) {
+            position += fast ? 1 + ( ( position - anchor ) >> 6 ) : 1;
+            continue;
+        }
+
+        for ( uint lazy = 0; lazy < finder->level.lazyDepth && position + 1 < matchEnd; ++lazy ) {
+            const Match next = findMatch( finder, position + 1 );
+            nextInsert = position + 2;
+            if ( next.length <= match.length ) break;
+            match = next;
+            ++position;
+        }
+
+        sink( context, input + anchor, position - anchor, match.length, match.distance );
+        const uint32_t matchStop = position + match.length;
+        //positions inside the match still have to be findable later
+        const uint32_t insertStop = matchStop < matchEnd ? matchStop : matchEnd;
+        if ( fast ) {
+            //just the last couple of positions, matches tend to continue there
+            for ( uint32_t i = insertStop > 2 && insertStop - 2 > nextInsert ? insertStop - 2 : nextInsert; i < insertStop; ++i ) {
+                finder->head[hashPosition( input + i )] = i;
+            }
+        } else {
+            for ( uint32_t i = nextInsert; i < insertStop; ++i ) {
+                insertPosition( finder, i );
+            }
+        }
+        position = anchor = matchStop;
+    }
+    sink( context, input + anchor, end - anchor, 0, 0 );
+}
+
+size_t lz_compressBound( const size_t inputSize ) {
+    //a 4 byte match costs at most a token and a 4 byte offset, so the streams
+    //never take more than 2 bytes per input byte
+    return NUM_STREAMS * STREAM_HEADER_SIZE + inputSize * 2 + 64;
+}
+
+/*
+* Writes one stream Huffman or rANS coded, whichever is smaller, or as is
+* when neither makes it smaller. rANS is only tried with tryRans set and when
+* the entropy says it could win, so faster levels never pay for coding twice.
+* Returns bytes written (header included) or 0 if out of room.
+*/
+static size_t writeStream( const uint8_t *stream, const size_t streamSize, uint8_t *output, const size_t outputCapacity, const bool tryRans,
+                           Arena* const arena ) {
+    if ( outputCapacity < STREAM_HEADER_SIZE ) return 0;
+    uint8_t *payload = output + STREAM_HEADER_SIZE;
+    const size_t payloadCapacity = outputCapacity - STREAM_HEADER_SIZE;
+    size_t codedSize = 0;
+    if ( streamSize >= MIN_CODED_STREAM_SIZE ) {
+        uint32_t counts[256];
+        histogram_count( stream, streamSize, counts );
+        codedSize = huffman_encodeBufferWithCounts( stream, streamSize, counts, payload, payloadCapacity, HUFFMAN_DEFAULT_MAX_KEY_LENGTH, true );
+        output[0] = STREAM_HUFFMAN;
+        //rANS only gets the room it needs to beat the best so far; order 1
+        //never pays for its tables on these streams
+        const size_t bestSize = codedSize && codedSize < streamSize ? codedSize : streamSize;
+        if ( tryRans && rans_worthTrying( counts, streamSize, bestSize ) ) {
+            const size_t mark = arena_mark( arena );
+            uint8_t *ransOutput = arena_alloc( arena, bestSize - 1 );
+            const size_t ransSize = ransOutput ? rans_compressBlock( stream, streamSize, ransOutput, bestSize - 1, 0, arena ) : 0;
+            if ( ransSize ) {
+                memcpy( payload, ransOutput, ransSize );
+                output[0] = STREAM_RANS;
+                codedSize = ransSize;
+            }
+            arena_release( arena, mark );
+        }
+    }
+    if ( !codedSize || codedSize >= streamSize ) {
+        if ( streamSize > payloadCapacity ) return 0;
+        memcpy( payload, stream, streamSize );
+        output[0] = STREAM_RAW;
+        codedSize = streamSize;
+    }
+    writeLE32( output + 1, streamSize );
+    writeLE32( output + 5, codedSize );
+    return STREAM_HEADER_SIZE + codedSize;
+}
+
+static bool validParams( const LzParams* const params ) {
+    if ( params->level < LZ_MIN_LEVEL || params->level > LZ_MAX_LEVEL ||
+         params->windowLog < LZ_MIN_WINDOW_LOG || params->windowLog > LZ_MAX_WINDOW_LOG ) {
+        fprintf( stderr, "Invalid level %u or window log %u (lz compress)\n", params->level, params->windowLog );
+        return false;
+    }
+    return true;
+}
+
+//allocates the hash head (and chain if the level walks one) from arena
+static bool createMatchFinder( MatchFinder* const finder, const uint8_t *input, const size_t inputSize, const LzParams* const params, const uint32_t maxLength,
+                               Arena* const arena ) {
+    //the chain never needs to be longer than the input
+    uint32_t windowSize = 1u << params->windowLog;
+    uint32_t chainSize = windowSize;
+    while ( chainSize / 2 >= inputSize && chainSize > 1u << LZ_MIN_WINDOW_LOG ) chainSize /= 2;
+
+    const bool needsChain = levelParams[params->level].chainDepth > 1;
+    uint32_t *head = arena_alloc( arena, ( sizeof( uint32_t ) << HASH_LOG ) + ( needsChain ? sizeof( uint32_t ) * chainSize : 0 ) );
+    if ( !head ) {
+        fprintf( stderr, "Cannot allocate match finder (lz compress)\n" );
+        return false;
+    }
+    memset( head, 0xFF, sizeof( uint32_t ) << HASH_LOG );
+
+    *finder = ( MatchFinder ) {
+                                .input = input,
+                                .inputSize = inputSize,
+                                .head = head,
+                                .chain = needsChain ? head + ( 1u << HASH_LOG ) : NULL,
+                                .windowMask = chainSize - 1,
+                                .windowSize = chainSize < windowSize ? chainSize : windowSize,
+                                .maxLength = maxLength,
+                                .level = levelParams[params->level]
+                              };
+    return true;
+}
+
+bool lz_parse( const uint8_t *input, const size_t inputSize, const LzParams *params, const uint32_t maxMatchLength, LzSequenceSink *sink, void *context,
+               Arena* const arena ) {
+    if ( !inputSize || inputSize > UINT32_MAX - 1 || maxMatchLength < LZ_MIN_MATCH || !validParams( params ) ) return false;
+    const size_t mark = arena_mark( arena );
+    MatchFinder finder;
+    if ( !createMatchFinder( &finder, input, inputSize, params, maxMatchLength, arena ) ) return false;
+    parseSequences( &finder, sink, context );
+    arena_release( arena, mark );
+    return true;
+}
+
+size_t lz_compressBlock( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity, const LzParams *params,
+                         Arena* const arena ) {
+    if ( !inputSize || inputSize > UINT32_MAX - 1 || !validParams( params ) ) return 0;
+
+    const size_t tokensCapacity = inputSize + inputSize / 255 + 16;
+    const size_t offsetsCapacity = ( inputSize / LZ_MIN_MATCH + 1 ) * 5;
+    const size_t mark = arena_mark( arena );
+    MatchFinder finder;
+    uint8_t *scratch = arena_alloc( arena, inputSize + tokensCapacity + offsetsCapacity );
+    size_t outputSize = 0;
+    if ( !scratch ) {
+        fprintf( stderr, "Cannot allocate match finder (lz compress)\n" );
+        goto cleanup;
+    }
+    if ( !createMatchFinder( &finder, input, inputSize, params, UINT32_MAX, arena ) ) goto cleanup;
+
+    SequenceStreams streams = {
+                                .literals = scratch,
+                                .tokens = scratch + inputSize,
+                                .offsets = scratch + inputSize + tokensCapacity
+                              };
+    parseSequences( &finder, putSequence, &streams );
+
+    const uint8_t *streamData[NUM_STREAMS] = { streams.literals, streams.tokens, streams.offsets };
+    const size_t streamSizes[NUM_STREAMS] = { streams.numLiterals, streams.numTokens, streams.numOffsets };
+    const bool tryRans = params->level >= LZ_DEFAULT_LEVEL;
+    for ( uint i = 0; i < NUM_STREAMS; ++i ) {
+        const size_t written = writeStream( streamData[i], streamSizes[i], output + outputSize, outputCapacity - outputSize, tryRans, arena );
+        if ( !written ) {
+            outputSize = 0;
+            goto cleanup;
+        }
+        outputSize += written;
+    }
+
+cleanup:
+    arena_release( arena, mark );
+    return outputSize;
+}
+
+//reads a length that continues in extra token bytes, false if they run out
+static inline bool getExtraLength( const uint8_t *tokens, const size_t numTokens, size_t* const tokenIndex, size_t* const value ) {
+    uint8_t byte;
+    do {
+        if ( *tokenIndex >= numTokens ) return false;
+        byte = tokens[( *tokenIndex )++];
+        *value += byte;
+    } while ( byte == 255 );
+    return true;
+}
+
+/*
+* Copies a match that may overlap its own output (distance < length repeats
+* the last distance bytes). Far enough from the end, 8 byte copies are safe
+* even when they write past the match, the next sequence overwrites it.
+*/
+static inline void copyMatch( uint8_t *output, const size_t distance, const size_t length, const uint8_t *outputEnd ) {
+    const uint8_t *source = output - distance;
+    if ( distance >= 8 && output + length + 8 <= outputEnd ) {
+        for ( size_t i = 0; i < length; i += 8 ) memcpy( output + i, source + i, 8 );
+        return;
+    }
+    for ( size_t i = 0; i < length; ++i ) output[i] = source[i];
+}
+
+size_t lz_decompressBlock( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputSize, Arena* const arena ) {
+    //headers first, so the three streams can share one buffer
+    size_t rawSizes[NUM_STREAMS];
+    size_t codedSizes[NUM_STREAMS];
+    uint8_t modes[NUM_STREAMS];
+    size_t position = 0;
+    size_t totalRaw = 0;
+    for ( uint i = 0; i < NUM_STREAMS; ++i ) {
+        if ( inputSize - position < STREAM_HEADER_SIZE ) return 0;
+        modes[i] = input[position];
+        rawSizes[i] = readLE32( input + position + 1 );
+        codedSizes[i] = readLE32( input + position + 5 );
+        position += STREAM_HEADER_SIZE;
+        if ( modes[i] > STREAM_RANS || codedSizes[i] > inputSize - position ) return 0;
+        if ( modes[i] == STREAM_RAW && codedSizes[i] != rawSizes[i] ) return 0;
+        if ( rawSizes[i] > outputSize * 2 + 64 ) return 0; //more than the encoder could ever produce
+        totalRaw += rawSizes[i];
+        position += codedSizes[i];
+    }
+
+    const size_t mark = arena_mark( arena );
+    uint8_t *scratch = arena_alloc( arena, totalRaw );
+    if ( !scratch ) return 0;
+    uint8_t *streamData[NUM_STREAMS];
+    size_t result = 0;
+    position = 0;
+    {
+        uint8_t *next = scratch;
+        for ( uint i = 0; i < NUM_STREAMS; ++i ) {
+            const uint8_t *payload = input + position + STREAM_HEADER_SIZE;
+            streamData[i] = next;
+            if ( modes[i] == STREAM_RAW ) {
+                memcpy( next, payload, rawSizes[i] );
+            } else if ( modes[i] == STREAM_HUFFMAN ) {
+                if ( huffman_decodeBuffer( payload, codedSizes[i], next, rawSizes[i], arena ) != rawSizes[i] ) goto cleanup;
+            } else if ( rans_decompressBlock( payload, codedSizes[i], next, rawSizes[i], arena ) != rawSizes[i] ) {
+                goto cleanup;
+            }
+            next += rawSizes[i];
+            position += STREAM_HEADER_SIZE + codedSizes[i];
+        }
+    }
+
+    const uint8_t *literals = streamData[0];
+    const uint8_t *tokens = streamData[1];
+    const uint8_t *offsets = streamData[2];
+    size_t literalIndex = 0, tokenIndex = 0, offsetIndex = 0;
+    size_t outputIndex = 0;
+    const uint8_t *outputEnd = output + outputSize;
+    while ( true ) {
+        if ( tokenIndex >= rawSizes[1] ) goto cleanup;
+        const uint8_t token = tokens[tokenIndex++];
+        size_t numLiterals = token >> 4;
+        size_t length = token & 15;
+        if ( numLiterals == 15 && !getExtraLength( tokens, rawSizes[1], &tokenIndex, &numLiterals ) ) goto cleanup;
+        if ( length == 15 && !getExtraLength( tokens, rawSizes[1], &tokenIndex, &length ) ) goto cleanup;
+
+        if ( numLiterals > rawSizes[0] - literalIndex || numLiterals > outputSize - outputIndex ) goto cleanup;
+        memcpy( output + outputIndex, literals + literalIndex, numLiterals );
+        literalIndex += numLiterals;
+        outputIndex += numLiterals;
+        if ( outputIndex == outputSize ) break;
+
+        size_t distance = 0;
+        for ( uint shift = 0; ; shift += 7 ) {
+            if ( offsetIndex >= rawSizes[2] || shift > 28 ) goto cleanup;
+            const uint8_t byte = offsets[offsetIndex++];
+            distance |= ( size_t ) ( byte & 0x7F ) << shift;
+            if ( !( byte & 0x80 ) ) break;
+        }
+        length += LZ_MIN_MATCH;
+        if ( !distance || distance > outputIndex || length > outputSize - outputIndex ) goto cleanup;
+        copyMatch( output + outputIndex, distance, length, outputEnd );
+        outputIndex += length;
+    }
+    //everything has to have been used up, or the block is not what was written
+    if ( literalIndex == rawSizes[0] && tokenIndex == rawSizes[1] && offsetIndex == rawSizes[2] ) result = outputSize;
+
+cleanup:
+    arena_release( arena, mark );
+    if ( !result ) fprintf( stderr, "Corrupt block (lz decompress)\n" );
+    return result;
+}
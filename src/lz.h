@@ -1,4 +1,61 @@
 #ifndef LZ_H
 #define LZ_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "arena.h"
+
+/*
+* LZ77 with a hash chain match finder. A block is coded as a list of
+* sequences (a run of literals, then a match of at least LZ_MIN_MATCH bytes
+* at some distance back), split into three streams that are each Huffman or
+* rANS coded on their own:
+*
+*   literals  the literal bytes of every sequence, back to back
+*   tokens    per sequence a byte with the literal run length in the high
+*             nibble and match length - LZ_MIN_MATCH in the low one, a
+*             nibble of 15 continues in extra bytes of 255 until one is < 255
+*   offsets   match distances as LEB128 varints
+*
+* The last sequence only has literals, the decoder knows it's the last one
+* because the output is full after them.
+*/
+#define LZ_MIN_MATCH 4
+#define LZ_MIN_LEVEL 1
+#define LZ_MAX_LEVEL 9
+#define LZ_DEFAULT_LEVEL 3
+#define LZ_MIN_WINDOW_LOG 10
+#define LZ_MAX_WINDOW_LOG 24
+#define LZ_DEFAULT_WINDOW_LOG 20
+
+typedef struct LzParams {
+    uint level;     //LZ_MIN_LEVEL (fastest) to LZ_MAX_LEVEL (smallest)
+    uint windowLog; //matches reach at most 1 << windowLog bytes back
+} LzParams;
+
+//output capacity lz_compressBlock can never run out of
+size_t lz_compressBound( size_t inputSize );
+
+//returns bytes written, 0 on bad params, empty input or allocation failure;
+//the match finder and the streams are allocated from arena
+size_t lz_compressBlock( const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputCapacity, const LzParams *params, Arena *arena );
+
+//decodes exactly outputSize bytes, returns outputSize or 0 on malformed input
+size_t lz_decompressBlock( const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputSize, Arena *arena );
+
+/*
+* Gets every sequence in order: numLiterals bytes starting at literals, then
+* matchLength bytes copied from distance back. The last one has matchLength 0.
+*/
+typedef void LzSequenceSink( void *context, const uint8_t *literals, size_t numLiterals, uint32_t matchLength, uint32_t distance );
+
+/*
+* Runs just the match finder, for formats with their own coding of the
+* sequences (DEFLATE). Matches are kept to maxMatchLength bytes and distances
+* under 1 << windowLog. Returns false on bad params, empty input or
+* allocation failure.
+*/
+bool lz_parse( const uint8_t *input, size_t inputSize, const LzParams *params, uint32_t maxMatchLength, LzSequenceSink *sink, void *context,
+               Arena *arena );
 
 #endif
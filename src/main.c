@@ -1,18 +1,357 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "huffman.h"
-#include "delta.h"
+#include <limits.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "stream.h"
+#include "codec.h"
+#include "dictionary.h"
+#include "histogram.h"
+#include "stats.h"
+#include "zip.h"
+
+#define DEFAULT_PIPELINE "lz"
+
+static void printUsage( FILE *output, const char *program ) {
+    fprintf( output,
+             "Usage: %s [-c | -d] [-l level] [-p pipeline] [-b block size] [-T threads] [-i] [input [output]]\n"
+             "       %s -r offset[:size] [-T threads] input [output]\n"
+             "       %s [-c | -d] -D dictionary [input [output]]\n"
+             "       %s --train dictionary [sample...]\n"
+             "       %s --gzip | --zip [-l level] [-b block size] [input [output]]\n"
+             "  -c              compress (default)\n"
+             "  -d              decompress\n"
+             "  -l level        1 (fastest) to 9 (smallest), each codec's default if not given\n"
+             "  -p, --pipeline  comma separated stages, default " DEFAULT_PIPELINE ", e.g. delta:stride4,lz,huffman\n"
+             "                  codecs: huffman[:max key length] lz[:window log] lwz[:code bits] bwt rans[:max order]\n"
+             "                          delta[:bits|byte|stride2|stride4|stride8|xor4|xor8]\n"
+             "                          auto[:max key length] (stored, runs, Huffman or delta Huffman per block)\n"
+             "  -b size         block size in bytes, k and m suffixes allowed\n"
+             "  -T threads      worker threads, 0 for one per CPU (default 1)\n"
+             "  -i, --index     append a block index for random access when compressing\n"
+             "  -r, --range offset[:size]\n"
+             "                  decompress only these bytes (to the end without a size) of a\n"
+             "                  file compressed with --index, suffixes as for -b\n"
+             "  -D, --dictionary file\n"
+             "                  code the input as one small message with a trained dictionary\n"
+             "  --train file    train a dictionary on the samples and write it to file\n"
+             "  --gzip          write gzip for stock tools instead, a member per block\n"
+             "  --zip           write a ZIP archive holding the input as one entry\n"
+             "  --stats         print time and bytes per stage as JSON on stderr when done\n"
+             "input and output default to stdin and stdout, - means the same\n",
+             program, program, program, program, program );
+}
+
+//a number with an optional k or m suffix, false if it isn't one or is over max
+static bool parseSize( const char *text, const unsigned long max, unsigned long* const value ) {
+    char *end;
+    unsigned long number = strtoul( text, &end, 10 );
+    if ( end == text || text[0] == '-' ) return false;
+    if ( *end == 'k' || *end == 'K' ) {
+        number <<= 10;
+        ++end;
+    } else if ( *end == 'm' || *end == 'M' ) {
+        number <<= 20;
+        ++end;
+    }
+    if ( *end || number > max ) return false;
+    *value = number;
+    return true;
+}
+
+//offset[:size], the size defaults to everything from offset on
+static bool parseRange( const char *text, uint64_t* const offset, uint64_t* const size ) {
+    char offsetText[32];
+    const char *colon = strchr( text, ':' );
+    const size_t offsetLength = colon ? ( size_t ) ( colon - text ) : strlen( text );
+    unsigned long value;
+    if ( offsetLength >= sizeof( offsetText ) ) return false;
+    memcpy( offsetText, text, offsetLength );
+    offsetText[offsetLength] = '\0';
+    if ( !parseSize( offsetText, ULONG_MAX, &value ) ) return false;
+    *offset = value;
+    *size = UINT64_MAX;
+    if ( colon ) {
+        if ( !parseSize( colon + 1, ULONG_MAX, &value ) ) return false;
+        *size = value;
+    }
+    return true;
+}
+
+//all of an input, malloc'd; NULL (after printing why) on a read error
+static uint8_t *readAll( InputFile *input, size_t* const size ) {
+    size_t capacity = 1 << 16;
+    uint8_t *buffer = NULL;
+    *size = 0;
+    while ( true ) {
+        uint8_t *grown = realloc( buffer, capacity );
+        if ( !grown ) {
+            fprintf( stderr, "Cannot allocate input buffer\n" );
+            free( buffer );
+            return NULL;
+        }
+        buffer = grown;
+        *size += inputFile_read( input, buffer + *size, capacity - *size );
+        if ( *size < capacity ) break;
+        capacity *= 2;
+    }
+    if ( inputFile_error( input ) ) {
+        fprintf( stderr, "Error reading input\n" );
+        free( buffer );
+        return NULL;
+    }
+    return buffer;
+}
+
+//counts characters over every sample file ("-" or none for stdin) and saves the dictionary
+static bool trainDictionary( const char *dictionaryFileName, char **samples, const int numSamples ) {
+    uint64_t counts[256] = {0};
+    uint8_t *chunk = malloc( STREAM_DEFAULT_BLOCK_SIZE );
+    if ( !chunk ) return false;
+    bool success = true;
+    for ( int i = 0; i < ( numSamples ? numSamples : 1 ) && success; ++i ) {
+        InputFile *input = inputFile_open( numSamples ? samples[i] : "-" );
+        if ( !input ) {
+            success = false;
+            break;
+        }
+        size_t chunkSize;
+        while ( ( chunkSize = inputFile_read( input, chunk, STREAM_DEFAULT_BLOCK_SIZE ) ) ) {
+            uint32_t chunkCounts[256];
+            histogram_count( chunk, chunkSize, chunkCounts );
+            for ( uint c = 0; c < 256; ++c ) counts[c] += chunkCounts[c];
+        }
+        success = !inputFile_error( input );
+        inputFile_close( input );
+    }
+    free( chunk );
+
+    Dictionary *dictionary = success ? dictionary_train( counts ) : NULL;
+    success = dictionary && dictionary_save( dictionary, dictionaryFileName );
+    dictionary_close( dictionary );
+    return success;
+}
+
+/*
+* gzip output as one member per block, which gunzip reads as a single stream,
+* so only a block is ever in memory. An empty input is one empty member.
+*/
+static bool writeGzip( InputFile *input, OutputFile *output, const uint32_t blockSize, const uint level ) {
+    const size_t capacity = zip_gzipBound( blockSize );
+    Arena *arena = arena_create( 0 );
+    uint8_t *buffer = inputFile_isMapped( input ) ? NULL : malloc( blockSize );
+    uint8_t *member = malloc( capacity );
+    bool success = arena && member && ( buffer || inputFile_isMapped( input ) );
+    if ( !success ) fprintf( stderr, "Cannot allocate gzip buffers\n" );
+    for ( bool first = true; success; first = false ) {
+        size_t size;
+        const uint8_t *block = buffer;
+        if ( buffer ) {
+            size = inputFile_read( input, buffer, blockSize );
+        } else {
+            block = inputFile_view( input, blockSize, &size );
+        }
+        if ( !size && !first ) break;
+        arena_reset( arena );
+        const size_t memberSize = zip_gzip( block, size, member, capacity, level, arena );
+        success = memberSize && outputFile_write( output, member, memberSize );
+        if ( size < blockSize ) break;
+    }
+    if ( success && inputFile_error( input ) ) {
+        fprintf( stderr, "Error reading input\n" );
+        success = false;
+    }
+    arena_close( arena );
+    free( buffer );
+    free( member );
+    return success;
+}
+
+//a ZIP archive with all of the input as one entry, named after the input file
+static bool writeZip( InputFile *input, const char *inputFileName, OutputFile *output, const uint level ) {
+    size_t size;
+    uint8_t *buffer = NULL;
+    const uint8_t *data = inputFile_isMapped( input ) ? inputFile_view( input, inputFile_remaining( input ), &size )
+                                                      : ( buffer = readAll( input, &size ) );
+    if ( !data ) return false;
+    const char *slash = strrchr( inputFileName, '/' );
+    ZipWriter *writer = zipWriter_create( output, level );
+    bool success = writer && zipWriter_add( writer, slash ? slash + 1 : inputFileName, data, size );
+    success = writer && zipWriter_finish( writer ) && success;
+    free( buffer );
+    return success;
+}
+
+static bool codeMessage( const char *dictionaryFileName, const bool decompress, InputFile *input, OutputFile *output ) {
+    Dictionary *dictionary = dictionary_load( dictionaryFileName );
+    if ( !dictionary ) return false;
+    size_t inputSize, outputSize = 0;
+    uint8_t *inputData = readAll( input, &inputSize );
+    uint32_t tableId;
+    size_t messageSize = 0;
+    bool valid = inputData != NULL;
+    if ( !decompress ) {
+        messageSize = inputSize;
+    } else if ( valid && !dictionary_readHeader( inputData, inputSize, &tableId, &messageSize ) ) {
+        fprintf( stderr, "Not a dictionary message\n" );
+        valid = false;
+    }
+    //the size in a header is untrusted, never allocate more than a message can be
+    if ( valid && messageSize > DICTIONARY_MAX_MESSAGE_SIZE ) {
+        fprintf( stderr, "Message of %zu bytes is over the %u byte limit\n", messageSize, DICTIONARY_MAX_MESSAGE_SIZE );
+        valid = false;
+    }
+    const size_t outputCapacity = decompress ? messageSize : dictionary_compressBound( messageSize );
+    uint8_t *outputData = valid ? malloc( outputCapacity ? outputCapacity : 1 ) : NULL;
+    if ( valid && !outputData ) fprintf( stderr, "Cannot allocate output buffer\n" );
+
+    bool success = false;
+    if ( outputData && !decompress ) {
+        outputSize = dictionary_compress( dictionary, inputData, inputSize, outputData, outputCapacity );
+        success = outputSize != 0;
+    } else if ( outputData ) {
+        success = dictionary_decompress( dictionary, inputData, inputSize, outputData, outputCapacity, &outputSize );
+    }
+    success = success && outputFile_write( output, outputData, outputSize );
+    free( inputData );
+    free( outputData );
+    dictionary_close( dictionary );
+    return success;
+}
 
 int main( int argc, char *argv[] ) {
-    char *outputFileName = "huffman_output";
-    char *inputFileName = "huffman_input";
-    huffman_encode( inputFileName, outputFileName );
-    huffman_decode( outputFileName );
+    static const struct option longOptions[] = {
+        { "pipeline", required_argument, NULL, 'p' },
+        { "dictionary", required_argument, NULL, 'D' },
+        { "train", required_argument, NULL, 't' },
+        { "stats", no_argument, NULL, 's' },
+        { "gzip", no_argument, NULL, 'g' },
+        { "zip", no_argument, NULL, 'z' },
+        { "index", no_argument, NULL, 'i' },
+        { "range", required_argument, NULL, 'r' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    bool decompress = false;
+    uint level = CODEC_DEFAULT_LEVEL;
+    const char *pipelineDescription = DEFAULT_PIPELINE;
+    const char *dictionaryFileName = NULL;
+    const char *trainFileName = NULL;
+    bool printStats = false;
+    bool gzip = false, zip = false;
+    bool ranged = false;
+    uint64_t rangeOffset = 0, rangeSize = 0;
+    StreamOptions options = { .blockSize = STREAM_DEFAULT_BLOCK_SIZE, .numThreads = 1 };
+    unsigned long value;
+    int option;
+    while ( ( option = getopt_long( argc, argv, "cdl:p:b:T:D:ir:h", longOptions, NULL ) ) != -1 ) {
+        switch ( option ) {
+            case 'c':
+                decompress = false;
+                break;
+            case 'd':
+                decompress = true;
+                break;
+            case 'l':
+                if ( !parseSize( optarg, CODEC_MAX_LEVEL, &value ) || !value ) {
+                    fprintf( stderr, "Invalid level %s\n", optarg );
+                    return 1;
+                }
+                level = value;
+                break;
+            case 'p':
+                pipelineDescription = optarg;
+                break;
+            case 'D':
+                dictionaryFileName = optarg;
+                break;
+            case 't':
+                trainFileName = optarg;
+                break;
+            case 'g':
+                gzip = true;
+                break;
+            case 'z':
+                zip = true;
+                break;
+            case 's':
+                if ( !stats_enabled() ) {
+                    fprintf( stderr, "Built without stats, rebuild with STATS=1\n" );
+                    return 1;
+                }
+                printStats = true;
+                break;
+            case 'b':
+                if ( !parseSize( optarg, STREAM_MAX_BLOCK_SIZE, &value ) || value < STREAM_MIN_BLOCK_SIZE ) {
+                    fprintf( stderr, "Invalid block size %s, %u to %u bytes\n", optarg, STREAM_MIN_BLOCK_SIZE, STREAM_MAX_BLOCK_SIZE );
+                    return 1;
+                }
+                options.blockSize = value;
+                break;
+            case 'T':
+                if ( !parseSize( optarg, 1024, &value ) ) {
+                    fprintf( stderr, "Invalid thread count %s\n", optarg );
+                    return 1;
+                }
+                options.numThreads = value;
+                break;
+            case 'i':
+                options.index = true;
+                break;
+            case 'r':
+                if ( !parseRange( optarg, &rangeOffset, &rangeSize ) ) {
+                    fprintf( stderr, "Invalid range %s, offset[:size]\n", optarg );
+                    return 1;
+                }
+                decompress = true;
+                ranged = true;
+                break;
+            case 'h':
+                printUsage( stdout, argv[0] );
+                return 0;
+            default:
+                printUsage( stderr, argv[0] );
+                return 1;
+        }
+    }
+    if ( trainFileName ) return trainDictionary( trainFileName, argv + optind, argc - optind ) ? 0 : 1;
+    if ( argc - optind > 2 || ( ranged && dictionaryFileName ) || ( gzip && zip ) ||
+         ( ( gzip || zip ) && ( decompress || dictionaryFileName || options.index ) ) ) {
+        printUsage( stderr, argv[0] );
+        return 1;
+    }
+    const char *inputFileName = optind < argc ? argv[optind] : "-";
+    const char *outputFileName = optind + 1 < argc ? argv[optind + 1] : "-";
+    if ( !decompress && !gzip && !zip && !pipeline_parse( pipelineDescription, level, &options.pipeline ) ) return 1;
 
-    char *delta_inputFileName = "delta_input";
-    char *delta_outputFileName = "delta_output";
-    deltaFileIntoFile( delta_inputFileName, delta_outputFileName );
+    InputFile *inputFile = inputFile_open( inputFileName );
+    if ( !inputFile ) return 1;
+    OutputFile *outputFile = outputFile_open( outputFileName );
+    if ( !outputFile ) {
+        inputFile_close( inputFile );
+        return 1;
+    }
 
-    return 0;
+    bool success;
+    const uint zipLevel = level == CODEC_DEFAULT_LEVEL ? ZIP_DEFAULT_LEVEL : level;
+    if ( gzip ) {
+        success = writeGzip( inputFile, outputFile, options.blockSize, zipLevel );
+    } else if ( zip ) {
+        success = writeZip( inputFile, inputFileName, outputFile, zipLevel );
+    } else if ( dictionaryFileName ) {
+        success = codeMessage( dictionaryFileName, decompress, inputFile, outputFile );
+    } else if ( ranged ) {
+        success = stream_decompressRange( inputFile, outputFile, &options, rangeOffset, rangeSize );
+    } else {
+        success = decompress ? stream_decompress( inputFile, outputFile, &options ) : stream_compress( inputFile, outputFile, &options );
+    }
+    success = outputFile_close( outputFile, success ) && success;
+    inputFile_close( inputFile );
+    if ( printStats ) {
+        Stats stats;
+        stats_get( &stats );
+        stats_writeJson( &stats, stderr );
+    }
+    return success ? 0 : 1;
 }
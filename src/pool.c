@@ -0,0 +1,117 @@
+#include "pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+struct ThreadPool {
+    pthread_mutex_t lock;
+    pthread_cond_t taskQueued;   //signalled when the queue gains a task or on shutdown
+    pthread_cond_t taskFinished; //broadcast whenever any task finishes
+    ThreadPoolTask *head;
+    ThreadPoolTask *tail;
+    bool shuttingDown;
+    uint numThreads;
+    uint numWorkers;             //numThreads if > 1 thread, else 0
+    pthread_t workers[];
+};
+
+static void *runWorker( void *argument ) {
+    ThreadPool *pool = argument;
+    pthread_mutex_lock( &pool->lock );
+    while ( true ) {
+        while ( !pool->head && !pool->shuttingDown ) {
+            pthread_cond_wait( &pool->taskQueued, &pool->lock );
+        }
+        if ( !pool->head ) break; //shutting down with nothing left to do
+
+        ThreadPoolTask *task = pool->head;
+        pool->head = task->next;
+        if ( !pool->head ) pool->tail = NULL;
+        pthread_mutex_unlock( &pool->lock );
+
+        task->run( task->argument );
+
+        pthread_mutex_lock( &pool->lock );
+        task->done = true;
+        pthread_cond_broadcast( &pool->taskFinished );
+    }
+    pthread_mutex_unlock( &pool->lock );
+    return NULL;
+}
+
+ThreadPool *threadPool_create( uint numThreads ) {
+    if ( !numThreads ) {
+        const long numCpus = sysconf( _SC_NPROCESSORS_ONLN );
+        numThreads = numCpus > 0 ? numCpus : 1;
+    }
+    //the calling thread mostly sleeps on I/O and waits, so every thread asked
+    //for is a worker, unless there's only one and the caller does it all
+    const uint numWorkers = numThreads > 1 ? numThreads : 0;
+
+    ThreadPool *pool = calloc( 1, sizeof( ThreadPool ) + numWorkers * sizeof( pthread_t ) );
+    if ( !pool ) return NULL;
+    pthread_mutex_init( &pool->lock, NULL );
+    pthread_cond_init( &pool->taskQueued, NULL );
+    pthread_cond_init( &pool->taskFinished, NULL );
+    pool->numThreads = numThreads;
+
+    for ( uint i = 0; i < numWorkers; ++i ) {
+        if ( pthread_create( &pool->workers[i], NULL, runWorker, pool ) ) {
+            fprintf( stderr, "Could not start worker thread %u (thread pool)\n", i );
+            threadPool_destroy( pool );
+            return NULL;
+        }
+        pool->numWorkers++;
+    }
+    return pool;
+}
+
+void threadPool_destroy( ThreadPool *pool ) {
+    if ( !pool ) return;
+    pthread_mutex_lock( &pool->lock );
+    pool->shuttingDown = true;
+    pthread_cond_broadcast( &pool->taskQueued );
+    pthread_mutex_unlock( &pool->lock );
+
+    for ( uint i = 0; i < pool->numWorkers; ++i ) {
+        pthread_join( pool->workers[i], NULL );
+    }
+    pthread_cond_destroy( &pool->taskFinished );
+    pthread_cond_destroy( &pool->taskQueued );
+    pthread_mutex_destroy( &pool->lock );
+    free( pool );
+}
+
+uint threadPool_numThreads( const ThreadPool *pool ) {
+    return pool->numThreads;
+}
+
+void threadPool_submit( ThreadPool *pool, ThreadPoolTask *task ) {
+    task->done = false;
+    task->next = NULL;
+    if ( !pool->numWorkers ) {
+        task->run( task->argument );
+        task->done = true;
+        return;
+    }
+
+    pthread_mutex_lock( &pool->lock );
+    if ( pool->tail ) {
+        pool->tail->next = task;
+    } else {
+        pool->head = task;
+    }
+    pool->tail = task;
+    pthread_cond_signal( &pool->taskQueued );
+    pthread_mutex_unlock( &pool->lock );
+}
+
+void threadPool_waitTask( ThreadPool *pool, ThreadPoolTask *task ) {
+    if ( !pool->numWorkers ) return;
+    pthread_mutex_lock( &pool->lock );
+    while ( !task->done ) {
+        pthread_cond_wait( &pool->taskFinished, &pool->lock );
+    }
+    pthread_mutex_unlock( &pool->lock );
+}
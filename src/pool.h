@@ -0,0 +1,29 @@
+#ifndef POOL_H
+#define POOL_H
+#include <stdlib.h>
+#include <stdbool.h>
+
+/*
+* Fixed size pool of worker threads pulling tasks off a FIFO queue. Tasks are
+* owned by the caller and must stay alive until threadPool_waitTask returns
+* for them. A pool with 1 thread starts no workers and runs every task inside
+* threadPool_submit, so single threaded callers pay nothing for it.
+*/
+typedef struct ThreadPoolTask {
+    void ( *run )( void *argument );
+    void *argument;
+    bool done;                   //set (under the pool lock) once run returns
+    struct ThreadPoolTask *next; //queue link, only touched by the pool
+} ThreadPoolTask;
+
+typedef struct ThreadPool ThreadPool;
+
+//0 means one thread per online CPU. Returns NULL if threads can't be started
+ThreadPool *threadPool_create( uint numThreads );
+void threadPool_destroy( ThreadPool *pool );
+uint threadPool_numThreads( const ThreadPool *pool );
+
+void threadPool_submit( ThreadPool *pool, ThreadPoolTask *task );
+void threadPool_waitTask( ThreadPool *pool, ThreadPoolTask *task );
+
+#endif
@@ -0,0 +1,408 @@
+#include "rans.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "histogram.h"
+#include "bitstream.h"
+#include "stats.h"
+
+//between characters every state stays in [LOWER_BOUND, LOWER_BOUND << 16),
+//under 2^31 so the encoder's reciprocals are exact
+#define LOWER_BOUND ( 1u << 15 )
+#define PROB_MASK ( RANS_PROB_SCALE - 1 )
+#define STATES_SIZE ( RANS_NUM_STATES * 4 )
+
+/*
+* Dividing the state by the frequency is the slow part of encoding, so it is
+* done as a multiply by a rounded up reciprocal and a shift (Giesen's trick,
+* exact for states under 2^31). A frequency of 1 can't have a 32 bit
+* reciprocal, it gets ~0 (off by one) and a bias that makes up for it.
+*/
+typedef struct EncodeSymbol {
+    uint32_t maxState; //a state at or above this sheds 16 bits before coding the character
+    uint32_t reciprocal;
+    uint32_t bias;
+    uint16_t complement; //RANS_PROB_SCALE - freq
+    uint16_t shift;
+} EncodeSymbol;
+
+/*
+* Scales counts (summing to total, which isn't 0) to frequencies summing to
+* RANS_PROB_SCALE. Every character that occurs keeps at least 1, the rounding
+* error goes to the most common one where it costs least.
+*/
+static void normalizeFrequencies( const uint32_t *counts, const uint64_t total, uint16_t *freqs ) {
+    uint sum = 0;
+    uint largest = 0;
+    for ( uint c = 0; c < 256; ++c ) {
+        freqs[c] = 0;
+        if ( !counts[c] ) continue;
+        const uint64_t scaled = ( ( uint64_t ) counts[c] * RANS_PROB_SCALE + total / 2 ) / total;
+        freqs[c] = scaled ? scaled : 1;
+        sum += freqs[c];
+        if ( counts[c] > counts[largest] ) largest = c;
+    }
+    if ( sum <= RANS_PROB_SCALE ) {
+        freqs[largest] += RANS_PROB_SCALE - sum;
+        return;
+    }
+    //too many rare characters were rounded up to 1, take it back from the
+    //largest frequencies, never more than half of one at a time
+    while ( sum > RANS_PROB_SCALE ) {
+        uint top = 0;
+        for ( uint c = 1; c < 256; ++c ) {
+            if ( freqs[c] > freqs[top] ) top = c;
+        }
+        const uint excess = sum - RANS_PROB_SCALE;
+        const uint taken = excess < freqs[top] / 2 ? excess : freqs[top] / 2;
+        freqs[top] -= taken;
+        sum -= taken;
+    }
+}
+
+static void buildEncodeTable( const uint16_t *freqs, EncodeSymbol *symbols ) {
+    uint start = 0;
+    for ( uint c = 0; c < 256; ++c ) {
+        const uint freq = freqs[c];
+        EncodeSymbol* const symbol = &symbols[c];
+        symbol->maxState = ( uint32_t ) freq << ( 31 - RANS_PROB_BITS );
+        symbol->complement = RANS_PROB_SCALE - freq;
+        if ( freq < 2 ) {
+            symbol->reciprocal = UINT32_MAX;
+            symbol->shift = 0;
+            symbol->bias = start + RANS_PROB_SCALE - 1;
+        } else {
+            uint shift = 0;
+            while ( 1u << shift < freq ) ++shift;
+            symbol->reciprocal = ( ( 1ull << ( shift + 31 ) ) + freq - 1 ) / freq;
+            symbol->shift = shift - 1;
+            symbol->bias = start;
+        }
+        start += freq;
+    }
+}
+
+//returns bytes written, 0 if the table doesn't fit
+static size_t writeTable( const uint16_t *freqs, uint8_t *output, const size_t outputCapacity ) {
+    if ( outputCapacity < 32 ) return 0;
+    memset( output, 0, 32 );
+    size_t size = 32;
+    for ( uint c = 0; c < 256; ++c ) {
+        if ( !freqs[c] ) continue;
+        if ( outputCapacity - size < 2 ) return 0;
+        output[c >> 3] |= 1 << ( c & 7 );
+        if ( freqs[c] < 0x80 ) {
+            output[size++] = freqs[c];
+        } else {
+            output[size++] = 0x80 | freqs[c] >> 8;
+            output[size++] = freqs[c] & 0xFF;
+        }
+    }
+    return size;
+}
+
+/*
+* Fills the RANS_PROB_SCALE decode slots of a table, each slot holding the
+* character, its frequency - 1 and its start as c | ( freq - 1 ) << 8 |
+* start << 20. Returns bytes read, 0 if the table is malformed.
+*/
+static size_t readTable( const uint8_t *input, const size_t inputSize, uint32_t *slots ) {
+    if ( inputSize < 32 ) return 0;
+    size_t position = 32;
+    uint start = 0;
+    for ( uint c = 0; c < 256; ++c ) {
+        if ( !( input[c >> 3] >> ( c & 7 ) & 1 ) ) continue;
+        if ( position >= inputSize ) return 0;
+        uint freq = input[position++];
+        if ( freq & 0x80 ) {
+            if ( position >= inputSize ) return 0;
+            freq = ( freq & 0x7F ) << 8 | input[position++];
+        }
+        if ( !freq || freq > RANS_PROB_SCALE - start ) return 0;
+        const uint32_t entry = c | ( freq - 1 ) << 8 | start << 20;
+        for ( uint slot = start; slot < start + freq; ++slot ) slots[slot] = entry;
+        start += freq;
+    }
+    return start == RANS_PROB_SCALE ? position : 0;
+}
+
+/*
+* Whether a state sheds a word is too unpredictable to branch on, so the low
+* word is always stored and next only moves past it when it is kept. The
+* caller makes sure there are 2 bytes of room below next.
+*/
+static inline void encodeCharacter( uint32_t* const state, const EncodeSymbol* const symbol, uint8_t** const next ) {
+    uint32_t x = *state;
+    const bool shed = x >= symbol->maxState;
+    ( *next )[-2] = x;
+    ( *next )[-1] = x >> 8;
+    *next -= shed * 2;
+    x = shed ? x >> 16 : x;
+    //x / freq * RANS_PROB_SCALE + x % freq + start
+    const uint32_t quotient = ( uint64_t ) x * symbol->reciprocal >> 32 >> symbol->shift;
+    *state = x + symbol->bias + quotient * symbol->complement;
+}
+
+/*
+* Codes the states and words of a block. rANS decodes in the reverse order
+* of encoding, so the characters go in backwards (the decoder's last row
+* first) and the words are written from the end of output down, then moved
+* to the front. tables[c] codes characters following c, only tables[0] is
+* used for order 0. Returns bytes written, 0 if they don't fit: the states
+* still need STATES_SIZE bytes after any character, so with less room than
+* a word per state left it can't fit anyway.
+*/
+__attribute__(( always_inline ))
+static inline size_t encodeStates( const uint8_t *input, const size_t inputSize, const EncodeSymbol *const *tables, const bool order1, uint8_t *output,
+                                   const size_t outputCapacity ) {
+    const size_t segmentSize = inputSize / RANS_NUM_STATES;
+    const size_t lastStart = ( RANS_NUM_STATES - 1 ) * segmentSize;
+    uint32_t states[RANS_NUM_STATES];
+    for ( uint k = 0; k < RANS_NUM_STATES; ++k ) states[k] = LOWER_BOUND;
+    uint8_t *next = output + outputCapacity;
+
+    //what the last segment has past the others
+    for ( size_t j = inputSize - lastStart; j-- > segmentSize; ) {
+        const size_t i = lastStart + j;
+        const EncodeSymbol *table = tables[order1 && j ? input[i - 1] : 0];
+        if ( next - output < 2 * RANS_NUM_STATES ) return 0;
+        encodeCharacter( &states[RANS_NUM_STATES - 1], &table[input[i]], &next );
+    }
+    for ( size_t j = segmentSize; j-- > 0; ) {
+        if ( next - output < 2 * RANS_NUM_STATES ) return 0;
+#pragma GCC unroll 4
+        for ( uint k = RANS_NUM_STATES; k-- > 0; ) {
+            const size_t i = k * segmentSize + j;
+            const EncodeSymbol *table = tables[order1 && j ? input[i - 1] : 0];
+            encodeCharacter( &states[k], &table[input[i]], &next );
+        }
+    }
+
+    if ( ( size_t ) ( next - output ) < STATES_SIZE ) return 0;
+    for ( uint k = RANS_NUM_STATES; k-- > 0; ) {
+        next -= 4;
+        writeLE32( next, states[k] );
+    }
+    const size_t size = output + outputCapacity - next;
+    memmove( output, next, size );
+    return size;
+}
+
+static inline uint8_t decodeCharacter( uint32_t* const state, const uint32_t* const slots, const uint8_t *input, const size_t inputSize,
+                                       size_t* const position ) {
+    uint32_t x = *state;
+    const uint32_t entry = slots[x & PROB_MASK];
+    x = ( ( entry >> 8 & PROB_MASK ) + 1 ) * ( x >> RANS_PROB_BITS ) + ( x & PROB_MASK ) - ( entry >> 20 );
+    //no branch on refilling either; past the end the load stays in bounds
+    //and decodeStates fails on the position afterwards
+    const size_t p = *position;
+    const uint8_t *word = input + ( p + 2 <= inputSize ? p : inputSize - 2 );
+    const uint32_t refill = x < LOWER_BOUND;
+    *state = x << ( refill * 16 ) | ( ( word[0] | word[1] << 8 ) & -refill );
+    *position = p + refill * 2;
+    return entry;
+}
+
+/*
+* Undoes encodeStates. The stream has to end exactly where the last word is
+* read, with every state back at LOWER_BOUND where the encoder started it,
+* which catches nearly any corruption.
+*/
+__attribute__(( always_inline ))
+static inline bool decodeStates( const uint8_t *input, const size_t inputSize, const uint32_t *const *tables, const bool order1, uint8_t *output,
+                                 const size_t outputSize ) {
+    if ( inputSize < STATES_SIZE ) return false;
+    uint32_t states[RANS_NUM_STATES];
+    uint8_t contexts[RANS_NUM_STATES];
+    for ( uint k = 0; k < RANS_NUM_STATES; ++k ) {
+        states[k] = readLE32( input + k * 4 );
+        contexts[k] = 0;
+    }
+    size_t position = STATES_SIZE;
+    const size_t segmentSize = outputSize / RANS_NUM_STATES;
+
+    for ( size_t j = 0; j < segmentSize; ++j ) {
+        //unrolled so the states stay in registers
+#pragma GCC unroll 4
+        for ( uint k = 0; k < RANS_NUM_STATES; ++k ) {
+            const uint32_t *slots = tables[order1 ? contexts[k] : 0];
+            if ( order1 && !slots ) return false;
+            contexts[k] = output[k * segmentSize + j] = decodeCharacter( &states[k], slots, input, inputSize, &position );
+        }
+    }
+    const uint last = RANS_NUM_STATES - 1;
+    for ( size_t i = last * segmentSize + segmentSize; i < outputSize; ++i ) {
+        const uint32_t *slots = tables[order1 ? contexts[last] : 0];
+        if ( order1 && !slots ) return false;
+        contexts[last] = output[i] = decodeCharacter( &states[last], slots, input, inputSize, &position );
+    }
+
+    if ( position != inputSize ) return false;
+    for ( uint k = 0; k < RANS_NUM_STATES; ++k ) {
+        if ( states[k] != LOWER_BOUND ) return false;
+    }
+    return true;
+}
+
+bool rans_worthTrying( const uint32_t *counts, const size_t inputSize, const size_t huffmanSize ) {
+    //order byte, bitmap, the states, then a frequency per character that
+    //takes two bytes once it scales to 128 or more
+    uint64_t tableSize = 1 + 32 + 4 * RANS_NUM_STATES;
+    for ( uint c = 0; c < 256; ++c ) {
+        if ( counts[c] ) tableSize += ( uint64_t ) counts[c] * RANS_PROB_SCALE >= 128 * ( uint64_t ) inputSize ? 2 : 1;
+    }
+    const uint64_t expected = histogram_entropyBits( counts, 256, inputSize ) / 8 + tableSize;
+    return expected + huffmanSize / 128 < huffmanSize;
+}
+
+size_t rans_compressBound( const size_t inputSize ) {
+    //order 0 always fits, every character sheds at most one word
+    return 1 + RANS_MAX_TABLE_SIZE + STATES_SIZE + inputSize * 2;
+}
+
+static size_t compressOrder0( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity ) {
+    if ( !outputCapacity ) return 0;
+    const uint64_t start = stats_now();
+    uint32_t counts[256];
+    histogram_count( input, inputSize, counts );
+    uint16_t freqs[256];
+    normalizeFrequencies( counts, inputSize, freqs );
+    EncodeSymbol symbols[256];
+    buildEncodeTable( freqs, symbols );
+    stats_addTable( STATS_TABLE_RANS, start, 0 );
+
+    output[0] = 0;
+    const size_t tableSize = writeTable( freqs, output + 1, outputCapacity - 1 );
+    if ( !tableSize ) return 0;
+    const size_t headerSize = 1 + tableSize;
+    const EncodeSymbol *tables[1] = { symbols };
+    const size_t codedSize = encodeStates( input, inputSize, tables, false, output + headerSize, outputCapacity - headerSize );
+    return codedSize ? headerSize + codedSize : 0;
+}
+
+static size_t compressOrder1( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity, Arena* const arena ) {
+    if ( outputCapacity < 1 + 32 ) return 0;
+    const uint64_t start = stats_now();
+    const size_t mark = arena_mark( arena );
+    uint32_t *counts = arena_alloc( arena, 256 * 256 * sizeof( uint32_t ) );
+    EncodeSymbol *symbols = arena_alloc( arena, 256 * 256 * sizeof( EncodeSymbol ) );
+    size_t outputSize = 0;
+    if ( !counts || !symbols ) {
+        fprintf( stderr, "Cannot allocate tables (rans compress)\n" );
+        goto cleanup;
+    }
+    histogram_countPairs( input, inputSize, counts );
+    //every segment starts out with no previous character, like the first
+    const size_t segmentSize = inputSize / RANS_NUM_STATES;
+    for ( uint k = 1; k < RANS_NUM_STATES && segmentSize; ++k ) {
+        const size_t i = k * segmentSize;
+        --counts[input[i - 1] << 8 | input[i]];
+        ++counts[input[i]];
+    }
+
+    output[0] = 1;
+    uint8_t *used = output + 1;
+    memset( used, 0, 32 );
+    size_t headerSize = 1 + 32;
+    const EncodeSymbol *tables[256] = { NULL };
+    for ( uint context = 0; context < 256; ++context ) {
+        const uint32_t *contextCounts = counts + ( context << 8 );
+        uint64_t total = 0;
+        for ( uint c = 0; c < 256; ++c ) total += contextCounts[c];
+        if ( !total ) continue;
+
+        uint16_t freqs[256];
+        normalizeFrequencies( contextCounts, total, freqs );
+        const size_t tableSize = writeTable( freqs, output + headerSize, outputCapacity - headerSize );
+        if ( !tableSize ) goto cleanup;
+        headerSize += tableSize;
+        used[context >> 3] |= 1 << ( context & 7 );
+        buildEncodeTable( freqs, symbols + ( context << 8 ) );
+        tables[context] = symbols + ( context << 8 );
+    }
+    stats_addTable( STATS_TABLE_RANS, start, 0 );
+    const size_t codedSize = encodeStates( input, inputSize, tables, true, output + headerSize, outputCapacity - headerSize );
+    if ( codedSize ) outputSize = headerSize + codedSize;
+
+cleanup:
+    arena_release( arena, mark );
+    return outputSize;
+}
+
+size_t rans_compressBlock( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity, const uint maxOrder,
+                           Arena* const arena ) {
+    if ( !inputSize || maxOrder > RANS_MAX_ORDER ) return 0;
+    //coding has to beat storing, so it gets no more room than the input and
+    //gives up as soon as it runs out
+    const size_t codedCapacity = outputCapacity < inputSize ? outputCapacity : inputSize;
+    size_t outputSize = compressOrder0( input, inputSize, output, codedCapacity );
+
+    //order 1 only has to beat order 0, so it gets a byte less room than that took
+    if ( maxOrder >= 1 && inputSize >= RANS_MIN_ORDER1_SIZE ) {
+        const size_t trialCapacity = outputSize ? outputSize - 1 : codedCapacity;
+        const size_t mark = arena_mark( arena );
+        uint8_t *trial = arena_alloc( arena, trialCapacity );
+        if ( trial ) {
+            const size_t trialSize = compressOrder1( input, inputSize, trial, trialCapacity, arena );
+            if ( trialSize ) {
+                memcpy( output, trial, trialSize );
+                outputSize = trialSize;
+            }
+        }
+        arena_release( arena, mark );
+    }
+    if ( outputSize || inputSize + 1 > outputCapacity ) return outputSize;
+    output[0] = RANS_STORED;
+    memcpy( output + 1, input, inputSize );
+    return inputSize + 1;
+}
+
+size_t rans_decompressBlock( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputSize, Arena* const arena ) {
+    if ( inputSize && input[0] == RANS_STORED && inputSize - 1 == outputSize ) {
+        memcpy( output, input + 1, outputSize );
+        return outputSize;
+    }
+    if ( !inputSize || !outputSize || input[0] > RANS_MAX_ORDER ) return 0;
+    const bool order1 = input[0] == 1;
+    const uint64_t start = stats_now();
+    const size_t mark = arena_mark( arena );
+    const uint32_t *tables[256] = { NULL };
+    size_t position = 1;
+    size_t result = 0;
+
+    if ( !order1 ) {
+        uint32_t *slots = arena_alloc( arena, RANS_PROB_SCALE * sizeof( uint32_t ) );
+        if ( !slots ) goto cleanup;
+        const size_t tableSize = readTable( input + position, inputSize - position, slots );
+        if ( !tableSize ) goto cleanup;
+        position += tableSize;
+        tables[0] = slots;
+    } else {
+        if ( inputSize - position < 32 ) goto cleanup;
+        const uint8_t *used = input + position;
+        position += 32;
+        for ( uint context = 0; context < 256; ++context ) {
+            if ( !( used[context >> 3] >> ( context & 7 ) & 1 ) ) continue;
+            uint32_t *slots = arena_alloc( arena, RANS_PROB_SCALE * sizeof( uint32_t ) );
+            if ( !slots ) goto cleanup;
+            const size_t tableSize = readTable( input + position, inputSize - position, slots );
+            if ( !tableSize ) goto cleanup;
+            position += tableSize;
+            tables[context] = slots;
+        }
+    }
+
+    stats_addTable( STATS_TABLE_RANS, start, 0 );
+
+    //separate calls so each order gets a decode loop of its own (decodeStates
+    //is always inlined)
+    if ( order1 ? decodeStates( input + position, inputSize - position, tables, true, output, outputSize ) :
+                  decodeStates( input + position, inputSize - position, tables, false, output, outputSize ) ) {
+        result = outputSize;
+    }
+
+cleanup:
+    arena_release( arena, mark );
+    if ( !result ) fprintf( stderr, "Corrupt block (rans decompress)\n" );
+    return result;
+}
@@ -0,0 +1,62 @@
+#ifndef RANS_H
+#define RANS_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "arena.h"
+
+/*
+* Static range ANS (Duda) entropy coder, the alternative to Huffman when
+* characters are so skewed that whole bit keys waste space. Frequencies are
+* counted once per block and scaled to RANS_PROB_BITS, a block carries its
+* tables. Order 0 has one table, order 1 has one per previous character.
+*
+* The block is split into RANS_NUM_STATES segments (the last takes the
+* remainder), each coded by its own 31 bit state but with their 16 bit
+* renormalization words interleaved in one stream, so the decoder works on
+* all segments at once. A block is:
+*
+*   order     1 byte, 0 or 1 (or RANS_STORED, see below)
+*   tables    order 0: one table; order 1: a 32 byte bitmap of the previous
+*             characters that have a table, then their tables in order
+*   states    final state of every segment, LE32 each
+*   words     renormalization words, LE16 each, in decoding order
+*
+* A table is a 32 byte bitmap of the characters that occur followed by
+* their frequencies, which sum to RANS_PROB_SCALE: below 128 in one byte,
+* otherwise two with the high bit of the first set. Blocks neither order
+* would make smaller are stored instead: an order byte of RANS_STORED and
+* the bytes as they are.
+*/
+#define RANS_PROB_BITS 12
+#define RANS_PROB_SCALE ( 1 << RANS_PROB_BITS )
+#define RANS_NUM_STATES 4
+#define RANS_MAX_ORDER 1
+#define RANS_STORED 0xFF
+#define RANS_MAX_TABLE_SIZE ( 32 + 2 * 256 )
+//order 1 tables cost too much to be worth trying on less
+#define RANS_MIN_ORDER1_SIZE ( 32 * 1024 )
+
+/*
+* Whether order 0 rANS can be expected to beat a Huffman coding of
+* huffmanSize bytes by a few percent, going by the entropy of counts (the
+* histogram of inputSize bytes) plus the cost of the table. Lets callers that
+* pick the smaller of the two skip coding with rANS when it can't win.
+*/
+bool rans_worthTrying( const uint32_t *counts, size_t inputSize, size_t huffmanSize );
+
+//output capacity rans_compressBlock can never run out of
+size_t rans_compressBound( size_t inputSize );
+
+/*
+* Codes input with an order 0 model, and if maxOrder is 1 and the input is
+* large enough also with an order 1 model, keeping whichever is smaller, or
+* stores input if neither is smaller than that. Returns bytes written, 0 if inputSize is 0, maxOrder is out of range or the
+* result doesn't fit in outputCapacity. Order 1 tables come from arena.
+*/
+size_t rans_compressBlock( const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputCapacity, uint maxOrder, Arena *arena );
+
+//decodes exactly outputSize bytes, returns outputSize or 0 on malformed input
+size_t rans_decompressBlock( const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputSize, Arena *arena );
+
+#endif
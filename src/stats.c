@@ -0,0 +1,115 @@
+#include "stats.h"
+#include <inttypes.h>
+#include "codec.h"
+
+static Stats counters;
+
+#ifdef CMPRS_STATS
+static inline void add( uint64_t* const counter, const uint64_t value ) {
+    __atomic_fetch_add( counter, value, __ATOMIC_RELAXED );
+}
+
+void stats_addStage( const uint codecId, const StatsDirection direction, const size_t bytesIn, const size_t bytesOut, const uint64_t start ) {
+    if ( codecId >= STATS_MAX_CODECS ) return;
+    StatsStage* const stage = &counters.stages[codecId][direction];
+    add( &stage->nanoseconds, stats_now() - start );
+    add( &stage->blocks, 1 );
+    add( &stage->bytesIn, bytesIn );
+    add( &stage->bytesOut, bytesOut );
+}
+
+void stats_addTable( const StatsTable table, const uint64_t start, const uint maxKeyLength ) {
+    add( &counters.tables[table].nanoseconds, stats_now() - start );
+    add( &counters.tables[table].builds, 1 );
+    uint32_t longest = __atomic_load_n( &counters.maxKeyLength, __ATOMIC_RELAXED );
+    while ( maxKeyLength > longest &&
+            !__atomic_compare_exchange_n( &counters.maxKeyLength, &longest, maxKeyLength, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) ) {
+    }
+}
+#endif
+
+bool stats_enabled( void ) {
+#ifdef CMPRS_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+static inline uint64_t load( const uint64_t* const counter ) {
+    return __atomic_load_n( counter, __ATOMIC_RELAXED );
+}
+
+static inline void clear( uint64_t* const counter ) {
+    __atomic_store_n( counter, 0, __ATOMIC_RELAXED );
+}
+
+void stats_get( Stats* const stats ) {
+    for ( uint id = 0; id < STATS_MAX_CODECS; ++id ) {
+        for ( uint direction = 0; direction < STATS_NUM_DIRECTIONS; ++direction ) {
+            const StatsStage* const stage = &counters.stages[id][direction];
+            stats->stages[id][direction] = ( StatsStage ) {
+                                                             .blocks = load( &stage->blocks ),
+                                                             .bytesIn = load( &stage->bytesIn ),
+                                                             .bytesOut = load( &stage->bytesOut ),
+                                                             .nanoseconds = load( &stage->nanoseconds )
+                                                           };
+        }
+    }
+    for ( uint table = 0; table < STATS_NUM_TABLES; ++table ) {
+        stats->tables[table].builds = load( &counters.tables[table].builds );
+        stats->tables[table].nanoseconds = load( &counters.tables[table].nanoseconds );
+    }
+    stats->maxKeyLength = __atomic_load_n( &counters.maxKeyLength, __ATOMIC_RELAXED );
+}
+
+void stats_reset( void ) {
+    for ( uint id = 0; id < STATS_MAX_CODECS; ++id ) {
+        for ( uint direction = 0; direction < STATS_NUM_DIRECTIONS; ++direction ) {
+            StatsStage* const stage = &counters.stages[id][direction];
+            clear( &stage->blocks );
+            clear( &stage->bytesIn );
+            clear( &stage->bytesOut );
+            clear( &stage->nanoseconds );
+        }
+    }
+    for ( uint table = 0; table < STATS_NUM_TABLES; ++table ) {
+        clear( &counters.tables[table].builds );
+        clear( &counters.tables[table].nanoseconds );
+    }
+    __atomic_store_n( &counters.maxKeyLength, 0, __ATOMIC_RELAXED );
+}
+
+static double seconds( const uint64_t nanoseconds ) {
+    return nanoseconds / 1e9;
+}
+
+//uncompressed bytes per second of stage time, 0 if no time was measured
+static double megabytesPerSecond( const uint64_t bytes, const uint64_t nanoseconds ) {
+    return nanoseconds ? bytes * 1e3 / nanoseconds : 0;
+}
+
+void stats_writeJson( const Stats* const stats, FILE* const output ) {
+    static const char *directionNames[STATS_NUM_DIRECTIONS] = { "compress", "decompress" };
+    static const char *tableNames[STATS_NUM_TABLES] = { "huffman", "rans" };
+    fprintf( output, "{\"stages\":[" );
+    bool first = true;
+    for ( uint id = 0; id < STATS_MAX_CODECS; ++id ) {
+        const Codec *codec = codec_findId( id );
+        for ( uint direction = 0; direction < STATS_NUM_DIRECTIONS; ++direction ) {
+            const StatsStage* const stage = &stats->stages[id][direction];
+            if ( !codec || !stage->blocks ) continue;
+            const uint64_t uncompressed = direction == STATS_COMPRESS ? stage->bytesIn : stage->bytesOut;
+            fprintf( output, "%s{\"codec\":\"%s\",\"direction\":\"%s\",\"blocks\":%" PRIu64 ",\"bytes_in\":%" PRIu64 ",\"bytes_out\":%" PRIu64 ",\"seconds\":%.6f,\"mbps\":%.2f}",
+                     first ? "" : ",", codec->name, directionNames[direction], stage->blocks, stage->bytesIn, stage->bytesOut,
+                     seconds( stage->nanoseconds ), megabytesPerSecond( uncompressed, stage->nanoseconds ) );
+            first = false;
+        }
+    }
+    fprintf( output, "],\"tables\":{" );
+    for ( uint table = 0; table < STATS_NUM_TABLES; ++table ) {
+        fprintf( output, "%s\"%s\":{\"builds\":%" PRIu64 ",\"seconds\":%.6f}", table ? "," : "", tableNames[table], stats->tables[table].builds,
+                 seconds( stats->tables[table].nanoseconds ) );
+    }
+    fprintf( output, "},\"max_key_length\":%u}\n", stats->maxKeyLength );
+}
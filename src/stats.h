@@ -0,0 +1,92 @@
+#ifndef STATS_H
+#define STATS_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+
+/*
+* Counters for finding out which stage is eating the time: per codec and
+* direction the blocks coded, bytes in and out and the time taken, and how
+* often and how long Huffman and rANS tables were built. Every thread adds
+* to the same counters (relaxed atomics, a handful per block), stats_get
+* takes a copy at any time.
+*
+* Only counted when built with CMPRS_STATS, which the Makefile defines
+* unless STATS=0. Without it the hooks below are empty inline functions that
+* compile away, and stats_get gives all zeros.
+*/
+//stage counters are indexed by codec id (see CodecId)
+#define STATS_MAX_CODECS 8
+
+typedef enum StatsDirection {
+    STATS_COMPRESS,
+    STATS_DECOMPRESS,
+    STATS_NUM_DIRECTIONS
+} StatsDirection;
+
+typedef enum StatsTable {
+    STATS_TABLE_HUFFMAN,
+    STATS_TABLE_RANS,
+    STATS_NUM_TABLES
+} StatsTable;
+
+typedef struct StatsStage {
+    uint64_t blocks;
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+    uint64_t nanoseconds; //summed over threads, so it can add up to more than the wall time
+} StatsStage;
+
+typedef struct StatsTables {
+    uint64_t builds;
+    uint64_t nanoseconds;
+} StatsTables;
+
+typedef struct Stats {
+    StatsStage stages[STATS_MAX_CODECS][STATS_NUM_DIRECTIONS];
+    StatsTables tables[STATS_NUM_TABLES];
+    uint32_t maxKeyLength; //longest Huffman key of any table built or read
+} Stats;
+
+#ifdef CMPRS_STATS
+static inline uint64_t stats_now( void ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return ( uint64_t ) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+//one block through a stage that started at start (a stats_now time)
+void stats_addStage( uint codecId, StatsDirection direction, size_t bytesIn, size_t bytesOut, uint64_t start );
+//one table built since start, maxKeyLength is 0 for rANS
+void stats_addTable( StatsTable table, uint64_t start, uint maxKeyLength );
+#else
+static inline uint64_t stats_now( void ) {
+    return 0;
+}
+
+static inline void stats_addStage( const uint codecId, const StatsDirection direction, const size_t bytesIn, const size_t bytesOut, const uint64_t start ) {
+    ( void ) codecId;
+    ( void ) direction;
+    ( void ) bytesIn;
+    ( void ) bytesOut;
+    ( void ) start;
+}
+
+static inline void stats_addTable( const StatsTable table, const uint64_t start, const uint maxKeyLength ) {
+    ( void ) table;
+    ( void ) start;
+    ( void ) maxKeyLength;
+}
+#endif
+
+//whether this build counts anything
+bool stats_enabled( void );
+void stats_get( Stats *stats );
+void stats_reset( void );
+
+//one JSON object with every stage that coded a block, and the tables
+void stats_writeJson( const Stats *stats, FILE *output );
+
+#endif
@@ -0,0 +1,601 @@
+#include "stream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "bitstream.h"
+#include "pool.h"
+#include "zip.h"
+
+static const uint8_t streamMagic[4] = { 'C', 'M', 'P', 'R' };
+static const uint8_t indexMagic[4] = { 'C', 'M', 'P', 'X' };
+#define STREAM_HEADER_SIZE 9
+#define INDEX_ENTRY_SIZE 20
+#define INDEX_FOOTER_SIZE 24
+#define BLOCK_HEADER_SIZE 12
+//version 2 block headers, without the CRC
+#define V2_BLOCK_HEADER_SIZE 8
+
+/*
+* One block in flight. The reading thread fills it, a worker compresses or
+* decompresses it, and the reading thread writes it out again once every
+* block before it has been written. The buffers are sized for a full block.
+* Data read from a mapped input isn't copied into a buffer at all, raw (when
+* compressing) or payload (when decompressing) points into the mapping. Each
+* job has its own codec context, so after the first few blocks nothing is
+* allocated per block. Range reads decode blocks they want whole straight
+* into the caller's buffer instead of rawBuffer.
+*/
+typedef struct BlockJob {
+    ThreadPoolTask task;
+    CodecContext *context;
+    const uint8_t *raw;
+    const uint8_t *payload;
+    uint8_t *rawBuffer;
+    uint8_t *payloadBuffer;
+    uint8_t *rawTarget;    //where decompressBlock writes, rawBuffer unless a range read says otherwise
+    uint64_t block;        //the block's number in the stream (and its index entry)
+    size_t rawSize;
+    size_t payloadSize;
+    size_t payloadCapacity;
+    uint32_t checksum;     //CRC-32 of the raw data, always when compressing, if checksummed otherwise
+    uint32_t expectedChecksum;
+    bool checksummed;
+    bool success;
+    bool inUse;
+} BlockJob;
+
+static void compressBlock( void *argument ) {
+    BlockJob *job = argument;
+    job->payloadSize = codecContext_compress( job->context, job->raw, job->rawSize, job->payloadBuffer, job->payloadCapacity );
+    job->success = job->payloadSize != 0;
+    if ( job->success ) job->checksum = zip_crc32( 0, job->raw, job->rawSize );
+}
+
+static void decompressBlock( void *argument ) {
+    BlockJob *job = argument;
+    job->success = codecContext_decompress( job->context, job->payload, job->payloadSize, job->rawTarget, job->rawSize ) == job->rawSize;
+    if ( job->success && job->checksummed ) {
+        job->checksum = zip_crc32( 0, job->rawTarget, job->rawSize );
+        job->success = job->checksum == job->expectedChecksum;
+    }
+}
+
+/*
+* Enough jobs for every thread to have one being worked on and one queued up
+* behind it while the reading thread waits on the oldest. Raw or payload
+* buffers are left out when they would only ever be views of the input.
+*/
+static BlockJob *createJobs( const uint numJobs, const Pipeline *pipeline, const uint32_t blockSize, void ( *run )( void * ),
+                             const bool rawBuffers, const bool payloadBuffers ) {
+    BlockJob *jobs = calloc( numJobs, sizeof( BlockJob ) );
+    if ( !jobs ) return NULL;
+    for ( uint i = 0; i < numJobs; ++i ) {
+        jobs[i].context = codecContext_create( pipeline );
+        jobs[i].payloadCapacity = pipeline_compressBound( pipeline, blockSize );
+        jobs[i].rawBuffer = rawBuffers ? malloc( blockSize ) : NULL;
+        jobs[i].payloadBuffer = payloadBuffers ? malloc( jobs[i].payloadCapacity ) : NULL;
+        jobs[i].raw = jobs[i].rawBuffer;
+        jobs[i].rawTarget = jobs[i].rawBuffer;
+        jobs[i].payload = jobs[i].payloadBuffer;
+        jobs[i].task = ( ThreadPoolTask ) { .run = run, .argument = &jobs[i] };
+        if ( !jobs[i].context || ( rawBuffers && !jobs[i].rawBuffer ) || ( payloadBuffers && !jobs[i].payloadBuffer ) ) {
+            for ( uint j = 0; j <= i; ++j ) {
+                codecContext_close( jobs[j].context );
+                free( jobs[j].rawBuffer );
+                free( jobs[j].payloadBuffer );
+            }
+            free( jobs );
+            return NULL;
+        }
+    }
+    return jobs;
+}
+
+static void destroyJobs( BlockJob *jobs, const uint numJobs ) {
+    if ( !jobs ) return;
+    for ( uint i = 0; i < numJobs; ++i ) {
+        codecContext_close( jobs[i].context );
+        free( jobs[i].rawBuffer );
+        free( jobs[i].payloadBuffer );
+    }
+    free( jobs );
+}
+
+/*
+* The block index while compressing: where the next block goes, and the
+* entries of those before it in their final form.
+*/
+typedef struct BlockIndex {
+    uint8_t *entries;
+    size_t size;
+    size_t capacity;
+    uint64_t numBlocks;
+    uint64_t offset;       //of the next block header, from the start of the stream
+    uint64_t rawOffset;
+} BlockIndex;
+
+static bool addIndexEntry( BlockIndex* const index, const BlockJob* const job ) {
+    if ( index->size + INDEX_ENTRY_SIZE > index->capacity ) {
+        const size_t capacity = index->capacity ? index->capacity * 2 : 1024 * INDEX_ENTRY_SIZE;
+        uint8_t *grown = realloc( index->entries, capacity );
+        if ( !grown ) return false;
+        index->entries = grown;
+        index->capacity = capacity;
+    }
+    uint8_t *entry = index->entries + index->size;
+    writeLE64( entry, index->offset );
+    writeLE64( entry + 8, index->rawOffset );
+    writeLE32( entry + 16, job->checksum );
+    index->size += INDEX_ENTRY_SIZE;
+    ++index->numBlocks;
+    index->offset += BLOCK_HEADER_SIZE + job->payloadSize;
+    index->rawOffset += job->rawSize;
+    return true;
+}
+
+static bool writeIndex( const BlockIndex* const index, OutputFile *output ) {
+    uint8_t footer[INDEX_FOOTER_SIZE];
+    writeLE64( footer, index->numBlocks );
+    writeLE64( footer + 8, index->rawOffset );
+    writeLE32( footer + 16, zip_crc32( 0, index->entries, index->size ) );
+    memcpy( footer + 20, indexMagic, 4 );
+    return outputFile_write( output, index->entries, index->size ) && outputFile_write( output, footer, INDEX_FOOTER_SIZE );
+}
+
+//waits for a compressed job and writes its block (and its index entry if indexing), false on any failure
+static bool writeCompressedJob( ThreadPool *pool, BlockJob *job, OutputFile *output, BlockIndex *index ) {
+    threadPool_waitTask( pool, &job->task );
+    job->inUse = false;
+    if ( !job->success ) {
+        fprintf( stderr, "Could not encode block (stream compress)\n" );
+        return false;
+    }
+    if ( index && !addIndexEntry( index, job ) ) {
+        fprintf( stderr, "Cannot allocate block index (stream compress)\n" );
+        return false;
+    }
+    uint8_t blockHeader[BLOCK_HEADER_SIZE];
+    writeLE32( blockHeader, job->rawSize );
+    writeLE32( blockHeader + 4, job->payloadSize );
+    writeLE32( blockHeader + 8, job->checksum );
+    return outputFile_write( output, blockHeader, BLOCK_HEADER_SIZE ) && outputFile_write( output, job->payload, job->payloadSize );
+}
+
+static bool writeDecompressedJob( ThreadPool *pool, BlockJob *job, OutputFile *output ) {
+    threadPool_waitTask( pool, &job->task );
+    job->inUse = false;
+    if ( !job->success ) {
+        fprintf( stderr, "Block %" PRIu64 " is corrupt (stream decompress)\n", job->block );
+        return false;
+    }
+    return outputFile_write( output, job->raw, job->rawSize );
+}
+
+/*
+* Blocks after a failure still have to be waited on before their buffers can
+* be freed, they just don't get written.
+*/
+static void drainJobs( ThreadPool *pool, BlockJob *jobs, const uint numJobs ) {
+    for ( uint i = 0; i < numJobs; ++i ) {
+        if ( jobs[i].inUse ) threadPool_waitTask( pool, &jobs[i].task );
+    }
+}
+
+bool stream_compress( InputFile *input, OutputFile *output, const StreamOptions *options ) {
+    const uint32_t blockSize = options->blockSize;
+    if ( blockSize < STREAM_MIN_BLOCK_SIZE || blockSize > STREAM_MAX_BLOCK_SIZE ) {
+        fprintf( stderr, "Block size %u out of range (stream compress)\n", blockSize );
+        return false;
+    }
+    const Pipeline *pipeline = &options->pipeline;
+    if ( !pipeline->numStages || !pipeline_checkInputSize( pipeline, blockSize ) ) return false;
+
+    ThreadPool *pool = threadPool_create( options->numThreads );
+    if ( !pool ) return false;
+    const uint numJobs = threadPool_numThreads( pool ) * 2;
+    const bool mapped = inputFile_isMapped( input );
+    BlockJob *jobs = createJobs( numJobs, pipeline, blockSize, compressBlock, !mapped, true );
+    BlockIndex indexData = {0};
+    BlockIndex *index = options->index ? &indexData : NULL;
+    bool success = false;
+    if ( !jobs ) {
+        fprintf( stderr, "Cannot allocate block buffers (stream compress)\n" );
+        goto cleanup;
+    }
+    uint8_t header[STREAM_HEADER_SIZE + 1 + PIPELINE_MAX_STAGES];
+    memcpy( header, streamMagic, 4 );
+    header[4] = STREAM_VERSION;
+    writeLE32( header + 5, blockSize );
+    header[STREAM_HEADER_SIZE] = pipeline->numStages;
+    for ( uint i = 0; i < pipeline->numStages; ++i ) header[STREAM_HEADER_SIZE + 1 + i] = pipeline->stages[i].codec->id;
+    const size_t headerSize = STREAM_HEADER_SIZE + 1 + pipeline->numStages;
+    if ( !outputFile_write( output, header, headerSize ) ) goto cleanup;
+    indexData.offset = headerSize;
+
+    //block i always goes into job i % numJobs, so the job about to be reused
+    //is also the oldest one not yet written
+    uint64_t blockIndex = 0;
+    while ( true ) {
+        BlockJob *job = &jobs[blockIndex % numJobs];
+        if ( job->inUse && !writeCompressedJob( pool, job, output, index ) ) goto cleanup;
+        if ( mapped ) {
+            job->raw = inputFile_view( input, blockSize, &job->rawSize );
+        } else {
+            job->rawSize = inputFile_read( input, job->rawBuffer, blockSize );
+        }
+        if ( !job->rawSize ) break;
+        job->inUse = true;
+        threadPool_submit( pool, &job->task );
+        ++blockIndex;
+    }
+    for ( uint i = 0; i < numJobs; ++i ) {
+        BlockJob *job = &jobs[( blockIndex + i ) % numJobs];
+        if ( job->inUse && !writeCompressedJob( pool, job, output, index ) ) goto cleanup;
+    }
+    if ( inputFile_error( input ) ) {
+        fprintf( stderr, "Error reading input (stream compress)\n" );
+        goto cleanup;
+    }
+
+    uint8_t endMarker[4] = {0};
+    success = outputFile_write( output, endMarker, 4 ) && ( !index || writeIndex( index, output ) );
+
+cleanup:
+    if ( jobs ) drainJobs( pool, jobs, numJobs );
+    destroyJobs( jobs, numJobs );
+    threadPool_destroy( pool );
+    free( indexData.entries );
+    return success;
+}
+
+/*
+* Reads the stream header up to the first block. Version 1 streams carry no
+* pipeline, they are plain Huffman.
+*/
+static bool readStreamHeader( InputFile *input, uint8_t* const version, uint32_t* const blockSize, Pipeline* const pipeline ) {
+    uint8_t header[STREAM_HEADER_SIZE];
+    if ( inputFile_read( input, header, sizeof( header ) ) != sizeof( header ) || memcmp( header, streamMagic, 4 ) ) {
+        fprintf( stderr, "Not a compressed stream (stream decompress)\n" );
+        return false;
+    }
+    *version = header[4];
+    if ( *version < 1 || *version > STREAM_VERSION ) {
+        fprintf( stderr, "Unsupported stream version %u (stream decompress)\n", *version );
+        return false;
+    }
+    *blockSize = readLE32( header + 5 );
+    if ( *blockSize < STREAM_MIN_BLOCK_SIZE || *blockSize > STREAM_MAX_BLOCK_SIZE ) {
+        fprintf( stderr, "Block size %u out of range (stream decompress)\n", *blockSize );
+        return false;
+    }
+
+    uint8_t ids[PIPELINE_MAX_STAGES] = { CODEC_HUFFMAN };
+    uint8_t numStages = 1;
+    if ( header[4] != 1 ) {
+        if ( inputFile_read( input, &numStages, 1 ) != 1 || !numStages || numStages > PIPELINE_MAX_STAGES ||
+             inputFile_read( input, ids, numStages ) != numStages ) {
+            fprintf( stderr, "Corrupt pipeline (stream decompress)\n" );
+            return false;
+        }
+    }
+    if ( !pipeline_fromIds( ids, numStages, pipeline ) ) {
+        fprintf( stderr, "Unknown codec in pipeline (stream decompress)\n" );
+        return false;
+    }
+    return true;
+}
+
+struct StreamReader {
+    ThreadPool *pool;
+    BlockJob *jobs;
+    uint numJobs;
+    uint32_t blockSize;
+    const uint8_t *stream;  //the mapped input from the "CMPR" on
+    const uint8_t *entries; //the index, in the mapping as well
+    size_t blockHeaderSize;
+    uint64_t numBlocks;
+    uint64_t blocksEnd;     //offset of the end marker
+    uint64_t size;
+};
+
+//where a block starts and ends in the stream (block header included) and in the uncompressed data
+typedef struct IndexEntry {
+    uint64_t offset;
+    uint64_t end;
+    uint64_t rawOffset;
+    uint64_t rawEnd;
+    uint32_t checksum;
+} IndexEntry;
+
+static IndexEntry readIndexEntry( const StreamReader* const reader, const uint64_t block ) {
+    const uint8_t *entry = reader->entries + block * INDEX_ENTRY_SIZE;
+    const bool last = block + 1 == reader->numBlocks;
+    return ( IndexEntry ) {
+                            .offset = readLE64( entry ),
+                            .end = last ? reader->blocksEnd : readLE64( entry + INDEX_ENTRY_SIZE ),
+                            .rawOffset = readLE64( entry + 8 ),
+                            .rawEnd = last ? reader->size : readLE64( entry + INDEX_ENTRY_SIZE + 8 ),
+                            .checksum = readLE32( entry + 16 )
+                          };
+}
+
+typedef enum IndexStatus {
+    INDEX_FOUND,
+    INDEX_MISSING,
+    INDEX_CORRUPT
+} IndexStatus;
+
+/*
+* Finds the block index at the end of a mapped stream of streamSize bytes
+* whose header has been read, and fills in where it is and what it says. The
+* entries are only checked against their CRC here, not against each other.
+*/
+static IndexStatus readIndex( StreamReader* const reader, const uint64_t streamSize, const uint64_t headerSize ) {
+    if ( streamSize < headerSize + 4 + INDEX_FOOTER_SIZE ) return INDEX_MISSING;
+    const uint8_t *footer = reader->stream + streamSize - INDEX_FOOTER_SIZE;
+    if ( memcmp( footer + 20, indexMagic, 4 ) ) return INDEX_MISSING;
+    reader->numBlocks = readLE64( footer );
+    reader->size = readLE64( footer + 8 );
+    if ( reader->numBlocks > ( streamSize - headerSize - 4 - INDEX_FOOTER_SIZE ) / INDEX_ENTRY_SIZE ) return INDEX_CORRUPT;
+    reader->entries = footer - reader->numBlocks * INDEX_ENTRY_SIZE;
+    reader->blocksEnd = reader->entries - 4 - reader->stream;
+    if ( zip_crc32( 0, reader->entries, reader->numBlocks * INDEX_ENTRY_SIZE ) != readLE32( footer + 16 ) ||
+         readLE32( reader->stream + reader->blocksEnd ) ) return INDEX_CORRUPT;
+    return INDEX_FOUND;
+}
+
+bool stream_decompress( InputFile *input, OutputFile *output, const StreamOptions *options ) {
+    const bool mapped = inputFile_isMapped( input );
+    size_t available;
+    const uint8_t *stream = mapped ? inputFile_view( input, 0, &available ) : NULL;
+    uint8_t version;
+    uint32_t blockSize;
+    Pipeline pipeline;
+    if ( !readStreamHeader( input, &version, &blockSize, &pipeline ) ) return false;
+
+    //version 2 block headers have no CRC, but if the stream has an index
+    //(which only a mapped input can get at) it holds one for every block
+    StreamReader index = { .stream = stream, .blockSize = blockSize, .blockHeaderSize = V2_BLOCK_HEADER_SIZE };
+    bool indexed = false;
+    if ( version == 2 && mapped ) {
+        const uint64_t headerSize = inputFile_view( input, 0, &available ) - stream;
+        const IndexStatus status = readIndex( &index, headerSize + inputFile_remaining( input ), headerSize );
+        if ( status == INDEX_CORRUPT ) {
+            fprintf( stderr, "Corrupt block index (stream decompress)\n" );
+            return false;
+        }
+        indexed = status == INDEX_FOUND;
+    }
+    const bool checksummed = version >= 3 || indexed;
+
+    ThreadPool *pool = threadPool_create( options->numThreads );
+    if ( !pool ) return false;
+    const uint numJobs = threadPool_numThreads( pool ) * 2;
+    BlockJob *jobs = createJobs( numJobs, &pipeline, blockSize, decompressBlock, true, !mapped );
+    bool success = false;
+    if ( !jobs ) {
+        fprintf( stderr, "Cannot allocate block buffers (stream decompress)\n" );
+        goto cleanup;
+    }
+    for ( uint i = 0; i < numJobs; ++i ) jobs[i].checksummed = checksummed;
+
+    uint64_t blockIndex = 0;
+    while ( true ) {
+        BlockJob *job = &jobs[blockIndex % numJobs];
+        if ( job->inUse && !writeDecompressedJob( pool, job, output ) ) goto cleanup;
+
+        uint8_t blockHeader[BLOCK_HEADER_SIZE];
+        const size_t blockHeaderSize = version >= 3 ? BLOCK_HEADER_SIZE : V2_BLOCK_HEADER_SIZE;
+        if ( inputFile_read( input, blockHeader, 4 ) != 4 ) goto truncated;
+        job->rawSize = readLE32( blockHeader );
+        if ( !job->rawSize ) break;
+        if ( inputFile_read( input, blockHeader + 4, blockHeaderSize - 4 ) != blockHeaderSize - 4 ) goto truncated;
+        job->payloadSize = readLE32( blockHeader + 4 );
+        if ( version >= 3 ) job->expectedChecksum = readLE32( blockHeader + 8 );
+        if ( indexed ) {
+            if ( blockIndex >= index.numBlocks ) goto mismatch;
+            job->expectedChecksum = readIndexEntry( &index, blockIndex ).checksum;
+        }
+        if ( job->rawSize > blockSize || job->payloadSize > job->payloadCapacity ) {
+            fprintf( stderr, "Corrupt block header (stream decompress)\n" );
+            goto cleanup;
+        }
+        size_t payloadRead;
+        if ( mapped ) {
+            job->payload = inputFile_view( input, job->payloadSize, &payloadRead );
+        } else {
+            payloadRead = inputFile_read( input, job->payloadBuffer, job->payloadSize );
+        }
+        if ( payloadRead != job->payloadSize ) goto truncated;
+        job->block = blockIndex;
+        job->inUse = true;
+        threadPool_submit( pool, &job->task );
+        ++blockIndex;
+    }
+    for ( uint i = 0; i < numJobs; ++i ) {
+        BlockJob *job = &jobs[( blockIndex + i ) % numJobs];
+        if ( job->inUse && !writeDecompressedJob( pool, job, output ) ) goto cleanup;
+    }
+    if ( indexed && blockIndex != index.numBlocks ) goto mismatch;
+    success = true;
+    goto cleanup;
+
+truncated:
+    fprintf( stderr, "Stream ends early (stream decompress)\n" );
+    goto cleanup;
+mismatch:
+    fprintf( stderr, "Block index doesn't match the blocks (stream decompress)\n" );
+cleanup:
+    if ( jobs ) drainJobs( pool, jobs, numJobs );
+    destroyJobs( jobs, numJobs );
+    threadPool_destroy( pool );
+    return success;
+}
+
+/*
+* Every block has to start where the one before it ends and hold at most a
+* block, so reads can trust the offsets without looking at the blocks.
+*/
+static bool checkIndex( const StreamReader* const reader, const uint64_t headerSize ) {
+    if ( !reader->numBlocks ) return reader->blocksEnd == headerSize && !reader->size;
+    const IndexEntry first = readIndexEntry( reader, 0 );
+    if ( first.offset != headerSize || first.rawOffset ) return false;
+    for ( uint64_t block = 0; block < reader->numBlocks; ++block ) {
+        const IndexEntry entry = readIndexEntry( reader, block );
+        if ( entry.end < entry.offset || entry.end - entry.offset < reader->blockHeaderSize ||
+             entry.rawEnd <= entry.rawOffset || entry.rawEnd - entry.rawOffset > reader->blockSize ) return false;
+    }
+    return true;
+}
+
+StreamReader *streamReader_open( InputFile *input, const uint numThreads ) {
+    size_t mapSize, available;
+    const uint8_t *map = inputFile_map( input, &mapSize );
+    if ( !map ) {
+        fprintf( stderr, "Random access needs a regular file (stream read)\n" );
+        return NULL;
+    }
+    StreamReader *reader = calloc( 1, sizeof( StreamReader ) );
+    if ( !reader ) return NULL;
+    //stdin can be mapped from somewhere in the middle, offsets count from the stream
+    reader->stream = inputFile_view( input, 0, &available );
+    const uint64_t streamSize = map + mapSize - reader->stream;
+    uint8_t version;
+    Pipeline pipeline;
+    if ( !readStreamHeader( input, &version, &reader->blockSize, &pipeline ) ) goto failed;
+    reader->blockHeaderSize = version >= 3 ? BLOCK_HEADER_SIZE : V2_BLOCK_HEADER_SIZE;
+    const uint64_t headerSize = inputFile_view( input, 0, &available ) - reader->stream;
+
+    const IndexStatus status = readIndex( reader, streamSize, headerSize );
+    if ( status == INDEX_MISSING ) {
+        fprintf( stderr, "No block index, compress with --index (stream read)\n" );
+        goto failed;
+    }
+    if ( status == INDEX_CORRUPT || !checkIndex( reader, headerSize ) ) goto corrupt;
+
+    reader->pool = threadPool_create( numThreads );
+    if ( !reader->pool ) goto failed;
+    reader->numJobs = threadPool_numThreads( reader->pool ) * 2;
+    reader->jobs = createJobs( reader->numJobs, &pipeline, reader->blockSize, decompressBlock, true, false );
+    if ( !reader->jobs ) {
+        fprintf( stderr, "Cannot allocate block buffers (stream read)\n" );
+        goto failed;
+    }
+    for ( uint i = 0; i < reader->numJobs; ++i ) reader->jobs[i].checksummed = true;
+    return reader;
+
+corrupt:
+    fprintf( stderr, "Corrupt block index (stream read)\n" );
+failed:
+    streamReader_close( reader );
+    return NULL;
+}
+
+void streamReader_close( StreamReader *reader ) {
+    if ( !reader ) return;
+    destroyJobs( reader->jobs, reader->numJobs );
+    threadPool_destroy( reader->pool );
+    free( reader );
+}
+
+uint64_t streamReader_size( const StreamReader* const reader ) {
+    return reader->size;
+}
+
+//the block holding byte offset of the uncompressed data, offset must be below the size
+static uint64_t findBlock( const StreamReader* const reader, const uint64_t offset ) {
+    uint64_t low = 0, high = reader->numBlocks - 1;
+    while ( low < high ) {
+        const uint64_t middle = low + ( high - low + 1 ) / 2;
+        if ( readLE64( reader->entries + middle * INDEX_ENTRY_SIZE + 8 ) <= offset ) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+//waits for a range job, checks it and copies the wanted part of a block that wasn't decoded in place
+static bool finishRangeJob( StreamReader *reader, BlockJob *job, const uint64_t offset, const uint64_t end, uint8_t *output ) {
+    threadPool_waitTask( reader->pool, &job->task );
+    job->inUse = false;
+    const IndexEntry entry = readIndexEntry( reader, job->block );
+    if ( !job->success ) {
+        fprintf( stderr, "Block %" PRIu64 " is corrupt (stream read)\n", job->block );
+        return false;
+    }
+    if ( job->rawTarget == job->rawBuffer ) {
+        const uint64_t start = entry.rawOffset > offset ? entry.rawOffset : offset;
+        const uint64_t stop = entry.rawEnd < end ? entry.rawEnd : end;
+        memcpy( output + ( start - offset ), job->rawBuffer + ( start - entry.rawOffset ), stop - start );
+    }
+    return true;
+}
+
+bool streamReader_read( StreamReader *reader, const uint64_t offset, const size_t size, uint8_t *output ) {
+    if ( offset > reader->size || size > reader->size - offset ) {
+        fprintf( stderr, "Range past the end of the data (stream read)\n" );
+        return false;
+    }
+    const uint64_t end = offset + size;
+    bool success = true;
+    //as in stream_decompress, the job about to be reused is the oldest one
+    uint64_t numSubmitted = 0;
+    for ( uint64_t block = size ? findBlock( reader, offset ) : reader->numBlocks; block < reader->numBlocks; ++block ) {
+        const IndexEntry entry = readIndexEntry( reader, block );
+        if ( entry.rawOffset >= end ) break;
+        BlockJob *job = &reader->jobs[numSubmitted % reader->numJobs];
+        if ( job->inUse && !finishRangeJob( reader, job, offset, end, output ) ) {
+            success = false;
+            break;
+        }
+        const uint8_t *blockHeader = reader->stream + entry.offset;
+        job->rawSize = entry.rawEnd - entry.rawOffset;
+        job->payloadSize = entry.end - entry.offset - reader->blockHeaderSize;
+        if ( readLE32( blockHeader ) != job->rawSize || readLE32( blockHeader + 4 ) != job->payloadSize || job->payloadSize > job->payloadCapacity ||
+             ( reader->blockHeaderSize == BLOCK_HEADER_SIZE && readLE32( blockHeader + 8 ) != entry.checksum ) ) {
+            fprintf( stderr, "Block %" PRIu64 " doesn't match the index (stream read)\n", block );
+            success = false;
+            break;
+        }
+        job->payload = blockHeader + reader->blockHeaderSize;
+        job->expectedChecksum = entry.checksum;
+        job->block = block;
+        //blocks wanted whole are decoded straight into place
+        job->rawTarget = entry.rawOffset >= offset && entry.rawEnd <= end ? output + ( entry.rawOffset - offset ) : job->rawBuffer;
+        job->inUse = true;
+        threadPool_submit( reader->pool, &job->task );
+        ++numSubmitted;
+    }
+    //also waits out the blocks still in flight after a failure
+    for ( uint i = 0; i < reader->numJobs; ++i ) {
+        BlockJob *job = &reader->jobs[( numSubmitted + i ) % reader->numJobs];
+        if ( job->inUse ) success = finishRangeJob( reader, job, offset, end, output ) && success;
+    }
+    return success;
+}
+
+bool stream_decompressRange( InputFile *input, OutputFile *output, const StreamOptions *options, uint64_t offset, uint64_t size ) {
+    StreamReader *reader = streamReader_open( input, options->numThreads );
+    if ( !reader ) return false;
+    if ( offset > reader->size ) offset = reader->size;
+    if ( size > reader->size - offset ) size = reader->size - offset;
+
+    //a block for every job per read, cut at block boundaries so no block is decoded twice
+    const uint64_t batchSize = ( uint64_t ) reader->numJobs * reader->blockSize;
+    uint8_t *batch = malloc( size < batchSize ? size + 1 : batchSize );
+    bool success = batch != NULL;
+    if ( !success ) fprintf( stderr, "Cannot allocate output buffer (stream read)\n" );
+    while ( success && size ) {
+        uint64_t readSize = batchSize - offset % reader->blockSize;
+        if ( readSize > size ) readSize = size;
+        success = streamReader_read( reader, offset, readSize, batch ) && outputFile_write( output, batch, readSize );
+        offset += readSize;
+        size -= readSize;
+    }
+    free( batch );
+    streamReader_close( reader );
+    return success;
+}
@@ -0,0 +1,77 @@
+#ifndef STREAM_H
+#define STREAM_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "codec.h"
+#include "fileio.h"
+
+/*
+* Block stream format, everything little endian:
+*
+*   "CMPR" magic, 1 byte version, 4 byte block size,
+*   1 byte number of pipeline stages, 1 byte codec id per stage
+*   for each block: 4 byte raw size, 4 byte payload size,
+*                   4 byte CRC-32 of the raw data, payload
+*   4 byte raw size of 0 to end the stream
+*
+* Every block goes through the pipeline on its own (see codec.h for the
+* payload), so a stream can be written and read in a single pass (pipes
+* included) while only ever holding one block in memory. Decoded blocks are
+* checked against their CRC before they are written out. Version 2 streams
+* have no CRC in the block header, version 1 streams no pipeline in the
+* header either and are Huffman only.
+*
+* With StreamOptions.index set the end marker is followed by a block index,
+* which readers going through the stream never get to:
+*
+*   for each block: 8 byte offset of its block header from the "CMPR",
+*                   8 byte offset of its first byte in the uncompressed data,
+*                   4 byte CRC-32 of its uncompressed data
+*   8 byte number of blocks, 8 byte uncompressed size,
+*   4 byte CRC-32 of the entries before, "CMPX" magic
+*/
+#define STREAM_VERSION 3
+#define STREAM_DEFAULT_BLOCK_SIZE ( 1 << 18 )
+#define STREAM_MIN_BLOCK_SIZE ( 1 << 10 )
+#define STREAM_MAX_BLOCK_SIZE ( 1 << 24 )
+
+typedef struct StreamOptions {
+    uint32_t blockSize;    //only used when compressing, the stream records it
+    Pipeline pipeline;     //only used when compressing, the stream records it
+    uint numThreads;       //0 for one per CPU, 1 does everything on the caller's thread
+    bool index;            //only used when compressing, appends the block index
+} StreamOptions;
+
+/*
+* Both return false (after printing why) on any I/O error or malformed input.
+* Blocks are handed to a pool of numThreads workers and written out in their
+* original order.
+*/
+bool stream_compress( InputFile *input, OutputFile *output, const StreamOptions *options );
+bool stream_decompress( InputFile *input, OutputFile *output, const StreamOptions *options );
+
+/*
+* Random access into a stream with a block index. Only the blocks overlapping
+* the range asked for are decoded, spread over numThreads workers, and every
+* one of them is checked against its CRC-32. The reader keeps its workers
+* and codec contexts between reads, so a read within one block costs about
+* decoding that block; smaller block sizes make point reads cheaper.
+*/
+typedef struct StreamReader StreamReader;
+
+//input must be a mapped (regular) file, NULL after printing why if it isn't or has no index
+StreamReader *streamReader_open( InputFile *input, uint numThreads );
+void streamReader_close( StreamReader *reader );
+
+//uncompressed size of the whole stream
+uint64_t streamReader_size( const StreamReader *reader );
+
+//decodes size bytes starting at offset into output, false (after printing why) if that runs past the end or a block is corrupt
+bool streamReader_read( StreamReader *reader, uint64_t offset, size_t size, uint8_t *output );
+
+//writes up to size bytes starting at offset to output, stopping early at the end of the data
+bool stream_decompressRange( InputFile *input, OutputFile *output, const StreamOptions *options, uint64_t offset, uint64_t size );
+
+#endif
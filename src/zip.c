@@ -1,3 +1,597 @@
 #include "zip.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "huffman.h"
+#include "lz.h"
+#include "bitstream.h"
+
+#define WINDOW_LOG 15
+#define MAX_MATCH 258
+#define NUM_LENGTH_CODES 29
+#define NUM_LITERAL_LENGTH_SYMBOLS ( 257 + NUM_LENGTH_CODES )
+//the fixed code also has keys for the two symbols that never occur
+#define NUM_FIXED_LITERAL_LENGTH_SYMBOLS 288
+#define NUM_DISTANCE_SYMBOLS 30
+#define NUM_CODE_LENGTH_SYMBOLS 19
+#define END_OF_BLOCK 256
+#define MAX_CODE_LENGTH_KEY_LENGTH 7
+//symbols collected before a block is written, same as zlib's default
+#define BLOCK_SYMBOLS ( 1 << 14 )
+#define MAX_STORED_SIZE 65535
+//block type bits, a stored block also pads to a byte and has LEN and NLEN
+#define BLOCK_STORED 0
+#define BLOCK_FIXED 1
+#define BLOCK_DYNAMIC 2
+#define STORED_HEADER_BITS ( 3 + 7 + 32 )
+#define GZIP_HEADER_SIZE 10
+#define GZIP_TRAILER_SIZE 8
+#define ZIP_LOCAL_HEADER_SIZE 30
+#define ZIP_CENTRAL_HEADER_SIZE 46
+#define ZIP_END_SIZE 22
+#define ZIP_METHOD_STORED 0
+#define ZIP_METHOD_DEFLATED 8
+#define ZIP_VERSION 20
+#define ZIP_MAX_ENTRIES 65535
+
+static const uint16_t lengthBases[NUM_LENGTH_CODES] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t lengthExtraBits[NUM_LENGTH_CODES] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t distanceBases[NUM_DISTANCE_SYMBOLS] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t distanceExtraBits[NUM_DISTANCE_SYMBOLS] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+//order the code length code lengths are sent in
+static const uint8_t codeLengthOrder[NUM_CODE_LENGTH_SYMBOLS] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+//a literal, or a match of some length at some distance
+typedef struct DeflateSymbol {
+    uint16_t literalLength; //the literal byte, or 256 + match length
+    uint16_t distance;      //0 for literals
+} DeflateSymbol;
+
+typedef struct BlockCodes {
+    uint8_t literalLengths[NUM_FIXED_LITERAL_LENGTH_SYMBOLS];
+    uint16_t literalKeys[NUM_FIXED_LITERAL_LENGTH_SYMBOLS];
+    uint8_t distanceLengths[NUM_DISTANCE_SYMBOLS];
+    uint16_t distanceKeys[NUM_DISTANCE_SYMBOLS];
+} BlockCodes;
+
+//the code length sequence of a dynamic block, run length coded
+typedef struct DynamicHeader {
+    uint numLiteralCodes;
+    uint numDistanceCodes;
+    uint numCodeLengthCodes;
+    uint8_t symbols[NUM_LITERAL_LENGTH_SYMBOLS + NUM_DISTANCE_SYMBOLS];
+    uint8_t extras[NUM_LITERAL_LENGTH_SYMBOLS + NUM_DISTANCE_SYMBOLS];
+    uint numSymbols;
+    uint8_t keyLengths[NUM_CODE_LENGTH_SYMBOLS];
+    uint16_t keys[NUM_CODE_LENGTH_SYMBOLS];
+    uint64_t bits;
+} DynamicHeader;
+
+typedef struct DeflateEncoder {
+    const uint8_t *input;
+    size_t blockStart; //first input byte of the pending block
+    size_t blockEnd;   //input covered by the pending symbols
+    DeflateSymbol *symbols;
+    uint numSymbols;
+    BitWriter writer;
+    bool final;
+    bool failed;
+} DeflateEncoder;
+
+typedef struct ZipEntry {
+    char *name;
+    uint32_t crc;
+    uint32_t compressedSize;
+    uint32_t size;
+    uint32_t offset;
+    uint16_t method;
+} ZipEntry;
+
+struct ZipWriter {
+    OutputFile *output;
+    uint level;
+    ZipEntry *entries;
+    uint numEntries;
+    uint entriesCapacity;
+    uint32_t offset;
+    uint16_t dosTime;
+    uint16_t dosDate;
+    Arena *arena; //deflate scratch and output, reused for every entry
+};
+
+/*
+* Built once on first use: the CRC slices, length and distance to code
+* lookups (distances over 256 are looked up by their top bits, the way zlib
+* does it) and the fixed Huffman code.
+*/
+static uint32_t crcTables[8][256];
+static uint8_t lengthCodes[MAX_MATCH + 1];
+static uint8_t distanceCodes[512];
+static BlockCodes fixedCodes;
+static pthread_once_t tablesOnce = PTHREAD_ONCE_INIT;
+
+static void buildTables( void ) {
+    for ( uint i = 0; i < 256; ++i ) {
+        uint32_t crc = i;
+        for ( uint bit = 0; bit < 8; ++bit ) crc = crc & 1 ? ( crc >> 1 ) ^ 0xEDB88320u : crc >> 1;
+        crcTables[0][i] = crc;
+    }
+    for ( uint slice = 1; slice < 8; ++slice ) {
+        for ( uint i = 0; i < 256; ++i ) {
+            const uint32_t previous = crcTables[slice - 1][i];
+            crcTables[slice][i] = ( previous >> 8 ) ^ crcTables[0][previous & 0xFF];
+        }
+    }
+
+    for ( uint code = 0; code < NUM_LENGTH_CODES; ++code ) {
+        for ( uint length = lengthBases[code]; length < lengthBases[code] + ( 1u << lengthExtraBits[code] ) && length <= MAX_MATCH; ++length ) {
+            lengthCodes[length] = code;
+        }
+    }
+    lengthCodes[MAX_MATCH] = NUM_LENGTH_CODES - 1; //258 has a code of its own
+    for ( uint code = 0; code < NUM_DISTANCE_SYMBOLS; ++code ) {
+        for ( uint distance = distanceBases[code]; distance < distanceBases[code] + ( 1u << distanceExtraBits[code] ); ++distance ) {
+            if ( distance - 1 < 256 ) {
+                distanceCodes[distance - 1] = code;
+            } else {
+                distanceCodes[256 + ( ( distance - 1 ) >> 7 )] = code;
+            }
+        }
+    }
+
+    for ( uint i = 0; i < NUM_FIXED_LITERAL_LENGTH_SYMBOLS; ++i ) {
+        fixedCodes.literalLengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    }
+    memset( fixedCodes.distanceLengths, 5, NUM_DISTANCE_SYMBOLS );
+    huffman_buildCanonicalKeys( fixedCodes.literalLengths, NUM_FIXED_LITERAL_LENGTH_SYMBOLS, fixedCodes.literalKeys );
+    huffman_buildCanonicalKeys( fixedCodes.distanceLengths, NUM_DISTANCE_SYMBOLS, fixedCodes.distanceKeys );
+}
+
+static inline uint distanceCode( const uint distance ) {
+    return distance <= 256 ? distanceCodes[distance - 1] : distanceCodes[256 + ( ( distance - 1 ) >> 7 )];
+}
+
+/*
+* Slicing-by-8: eight table lookups fold a whole 64 bit word into the CRC
+* per step instead of one lookup per byte. Loads are little endian.
+*/
+uint32_t zip_crc32( uint32_t crc, const uint8_t *input, size_t inputSize ) {
+    pthread_once( &tablesOnce, buildTables );
+    crc = ~crc;
+    for ( ; inputSize && ( ( uintptr_t ) input & 7 ); --inputSize ) {
+        crc = crcTables[0][( crc ^ *input++ ) & 0xFF] ^ ( crc >> 8 );
+    }
+    for ( ; inputSize >= 8; inputSize -= 8, input += 8 ) {
+        uint64_t word;
+        memcpy( &word, input, 8 );
+        const uint32_t low = ( uint32_t ) word ^ crc;
+        const uint32_t high = word >> 32;
+        crc = crcTables[7][low & 0xFF] ^ crcTables[6][( low >> 8 ) & 0xFF] ^
+              crcTables[5][( low >> 16 ) & 0xFF] ^ crcTables[4][low >> 24] ^
+              crcTables[3][high & 0xFF] ^ crcTables[2][( high >> 8 ) & 0xFF] ^
+              crcTables[1][( high >> 16 ) & 0xFF] ^ crcTables[0][high >> 24];
+    }
+    for ( ; inputSize; --inputSize ) {
+        crc = crcTables[0][( crc ^ *input++ ) & 0xFF] ^ ( crc >> 8 );
+    }
+    return ~crc;
+}
+
+static inline void writeLE16( uint8_t* const output, const uint16_t value ) {
+    output[0] = value;
+    output[1] = value >> 8;
+}
+
+//bits the symbols of a block take with the given code, end of block included
+static uint64_t blockBits( const uint32_t *literalCounts, const uint32_t *distanceCounts, const BlockCodes* const codes ) {
+    uint64_t bits = 0;
+    for ( uint i = 0; i < NUM_LITERAL_LENGTH_SYMBOLS; ++i ) bits += ( uint64_t ) literalCounts[i] * codes->literalLengths[i];
+    for ( uint i = 0; i < NUM_DISTANCE_SYMBOLS; ++i ) bits += ( uint64_t ) distanceCounts[i] * codes->distanceLengths[i];
+    return bits;
+}
+
+//turns the run of count copies of length into code length symbols
+static void putCodeLengthRun( DynamicHeader* const header, const uint8_t length, uint count ) {
+    if ( !length ) {
+        while ( count >= 11 ) {
+            const uint run = count < 138 ? count : 138;
+            header->symbols[header->numSymbols] = 18;
+            header->extras[header->numSymbols++] = run - 11;
+            count -= run;
+        }
+        if ( count >= 3 ) {
+            header->symbols[header->numSymbols] = 17;
+            header->extras[header->numSymbols++] = count - 3;
+            count = 0;
+        }
+    } else {
+        header->symbols[header->numSymbols++] = length;
+        --count;
+        while ( count >= 3 ) {
+            const uint run = count < 6 ? count : 6;
+            header->symbols[header->numSymbols] = 16;
+            header->extras[header->numSymbols++] = run - 3;
+            count -= run;
+        }
+    }
+    while ( count-- ) header->symbols[header->numSymbols++] = length;
+}
+
+/*
+* Builds the run length coded key lengths of both codes and the code that
+* codes them, and works out how many bits all of it takes.
+*/
+static bool buildDynamicHeader( const BlockCodes* const codes, DynamicHeader* const header ) {
+    header->numLiteralCodes = NUM_LITERAL_LENGTH_SYMBOLS;
+    while ( header->numLiteralCodes > 257 && !codes->literalLengths[header->numLiteralCodes - 1] ) --header->numLiteralCodes;
+    header->numDistanceCodes = NUM_DISTANCE_SYMBOLS;
+    while ( header->numDistanceCodes > 1 && !codes->distanceLengths[header->numDistanceCodes - 1] ) --header->numDistanceCodes;
+
+    //runs may cross from the literal/length lengths into the distance ones
+    uint8_t lengths[NUM_LITERAL_LENGTH_SYMBOLS + NUM_DISTANCE_SYMBOLS];
+    const uint numLengths = header->numLiteralCodes + header->numDistanceCodes;
+    memcpy( lengths, codes->literalLengths, header->numLiteralCodes );
+    memcpy( lengths + header->numLiteralCodes, codes->distanceLengths, header->numDistanceCodes );
+    header->numSymbols = 0;
+    for ( uint i = 0; i < numLengths; ) {
+        uint run = 1;
+        while ( i + run < numLengths && lengths[i + run] == lengths[i] ) ++run;
+        putCodeLengthRun( header, lengths[i], run );
+        i += run;
+    }
+
+    uint32_t counts[NUM_CODE_LENGTH_SYMBOLS] = {0};
+    for ( uint i = 0; i < header->numSymbols; ++i ) counts[header->symbols[i]]++;
+    if ( !huffman_buildKeyLengths( counts, NUM_CODE_LENGTH_SYMBOLS, MAX_CODE_LENGTH_KEY_LENGTH, header->keyLengths ) ) return false;
+    //inflaters reject an incomplete code length code, a lone symbol gets a partner
+    uint numUsed = 0;
+    for ( uint i = 0; i < NUM_CODE_LENGTH_SYMBOLS; ++i ) numUsed += header->keyLengths[i] != 0;
+    if ( numUsed == 1 ) header->keyLengths[header->keyLengths[0] ? 1 : 0] = 1;
+    huffman_buildCanonicalKeys( header->keyLengths, NUM_CODE_LENGTH_SYMBOLS, header->keys );
+
+    header->numCodeLengthCodes = NUM_CODE_LENGTH_SYMBOLS;
+    while ( header->numCodeLengthCodes > 4 && !header->keyLengths[codeLengthOrder[header->numCodeLengthCodes - 1]] ) --header->numCodeLengthCodes;
+
+    header->bits = 5 + 5 + 4 + 3 * header->numCodeLengthCodes;
+    for ( uint i = 0; i < header->numSymbols; ++i ) {
+        const uint8_t symbol = header->symbols[i];
+        header->bits += header->keyLengths[symbol] + ( symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0 );
+    }
+    return true;
+}
+
+static void writeDynamicHeader( const DynamicHeader* const header, BitWriter* const writer ) {
+    bitWriter_put( writer, header->numLiteralCodes - 257, 5 );
+    bitWriter_put( writer, header->numDistanceCodes - 1, 5 );
+    bitWriter_put( writer, header->numCodeLengthCodes - 4, 4 );
+    bitWriter_flush( writer );
+    for ( uint i = 0; i < header->numCodeLengthCodes; ++i ) {
+        bitWriter_put( writer, header->keyLengths[codeLengthOrder[i]], 3 );
+        bitWriter_flush( writer );
+    }
+    for ( uint i = 0; i < header->numSymbols; ++i ) {
+        const uint8_t symbol = header->symbols[i];
+        bitWriter_put( writer, header->keys[symbol], header->keyLengths[symbol] );
+        if ( symbol >= 16 ) bitWriter_put( writer, header->extras[i], symbol == 16 ? 2 : symbol == 17 ? 3 : 7 );
+        bitWriter_flush( writer );
+    }
+}
+
+//a literal/length key, length extra bits, distance key and distance extra bits
+//take at most 48 bits, so one flush per symbol
+static void writeSymbols( const DeflateSymbol *symbols, const uint numSymbols, const BlockCodes* const codes, BitWriter* const writer ) {
+    for ( uint i = 0; i < numSymbols; ++i ) {
+        const DeflateSymbol symbol = symbols[i];
+        if ( !symbol.distance ) {
+            bitWriter_put( writer, codes->literalKeys[symbol.literalLength], codes->literalLengths[symbol.literalLength] );
+        } else {
+            const uint length = symbol.literalLength - 256;
+            const uint lengthCode = lengthCodes[length];
+            bitWriter_put( writer, codes->literalKeys[257 + lengthCode], codes->literalLengths[257 + lengthCode] );
+            bitWriter_put( writer, length - lengthBases[lengthCode], lengthExtraBits[lengthCode] );
+            const uint code = distanceCode( symbol.distance );
+            bitWriter_put( writer, codes->distanceKeys[code], codes->distanceLengths[code] );
+            bitWriter_put( writer, symbol.distance - distanceBases[code], distanceExtraBits[code] );
+        }
+        bitWriter_flush( writer );
+    }
+    bitWriter_put( writer, codes->literalKeys[END_OF_BLOCK], codes->literalLengths[END_OF_BLOCK] );
+    bitWriter_flush( writer );
+}
+
+//the block's input as is, split into chunks of at most MAX_STORED_SIZE
+static void writeStored( const uint8_t *input, size_t inputSize, const bool final, BitWriter* const writer ) {
+    do {
+        const size_t chunkSize = inputSize < MAX_STORED_SIZE ? inputSize : MAX_STORED_SIZE;
+        inputSize -= chunkSize;
+        bitWriter_put( writer, final && !inputSize, 1 );
+        bitWriter_put( writer, BLOCK_STORED, 2 );
+        bitWriter_put( writer, 0, ( 8 - writer->count % 8 ) % 8 );
+        bitWriter_put( writer, chunkSize, 16 );
+        bitWriter_put( writer, ~chunkSize & 0xFFFF, 16 );
+        bitWriter_flush( writer );
+        memcpy( writer->output + writer->position, input, chunkSize );
+        writer->position += chunkSize;
+        input += chunkSize;
+    } while ( inputSize );
+}
+
+/*
+* Writes the pending symbols as whichever block type comes out smallest: a
+* dynamic code built for them, the fixed code, or the raw input.
+*/
+static void writeBlock( DeflateEncoder* const encoder ) {
+    if ( encoder->failed ) return;
+    uint32_t literalCounts[NUM_LITERAL_LENGTH_SYMBOLS] = {0};
+    uint32_t distanceCounts[NUM_DISTANCE_SYMBOLS] = {0};
+    uint64_t extraBits = 0;
+    literalCounts[END_OF_BLOCK] = 1;
+    for ( uint i = 0; i < encoder->numSymbols; ++i ) {
+        const DeflateSymbol symbol = encoder->symbols[i];
+        if ( !symbol.distance ) {
+            literalCounts[symbol.literalLength]++;
+            continue;
+        }
+        const uint lengthCode = lengthCodes[symbol.literalLength - 256];
+        const uint code = distanceCode( symbol.distance );
+        literalCounts[257 + lengthCode]++;
+        distanceCounts[code]++;
+        extraBits += lengthExtraBits[lengthCode] + distanceExtraBits[code];
+    }
+
+    BlockCodes dynamicCodes;
+    DynamicHeader header;
+    if ( !huffman_buildKeyLengths( literalCounts, NUM_LITERAL_LENGTH_SYMBOLS, HUFFMAN_MAX_KEY_LENGTH, dynamicCodes.literalLengths ) ||
+         !huffman_buildKeyLengths( distanceCounts, NUM_DISTANCE_SYMBOLS, HUFFMAN_MAX_KEY_LENGTH, dynamicCodes.distanceLengths ) ) {
+        encoder->failed = true;
+        return;
+    }
+    //a block without matches still has to describe one distance code
+    bool hasDistances = false;
+    for ( uint i = 0; i < NUM_DISTANCE_SYMBOLS; ++i ) hasDistances |= dynamicCodes.distanceLengths[i] != 0;
+    if ( !hasDistances ) dynamicCodes.distanceLengths[0] = 1;
+    if ( !buildDynamicHeader( &dynamicCodes, &header ) ) {
+        encoder->failed = true;
+        return;
+    }
+
+    const size_t storedSize = encoder->blockEnd - encoder->blockStart;
+    const size_t numChunks = storedSize ? ( storedSize + MAX_STORED_SIZE - 1 ) / MAX_STORED_SIZE : 1;
+    const uint64_t storedBits = numChunks * STORED_HEADER_BITS + storedSize * 8;
+    const uint64_t fixedBits = 3 + blockBits( literalCounts, distanceCounts, &fixedCodes ) + extraBits;
+    const uint64_t dynamicBits = 3 + header.bits + blockBits( literalCounts, distanceCounts, &dynamicCodes ) + extraBits;
+
+    BitWriter* const writer = &encoder->writer;
+    const uint64_t bestBits = storedBits < fixedBits && storedBits < dynamicBits ? storedBits : fixedBits < dynamicBits ? fixedBits : dynamicBits;
+    if ( bestBits / 8 + 2 > bitWriter_available( writer ) ) {
+        encoder->failed = true;
+        return;
+    }
+
+    if ( bestBits == storedBits ) {
+        writeStored( encoder->input + encoder->blockStart, storedSize, encoder->final, writer );
+    } else if ( bestBits == fixedBits ) {
+        bitWriter_put( writer, encoder->final, 1 );
+        bitWriter_put( writer, BLOCK_FIXED, 2 );
+        writeSymbols( encoder->symbols, encoder->numSymbols, &fixedCodes, writer );
+    } else {
+        huffman_buildCanonicalKeys( dynamicCodes.literalLengths, NUM_LITERAL_LENGTH_SYMBOLS, dynamicCodes.literalKeys );
+        huffman_buildCanonicalKeys( dynamicCodes.distanceLengths, NUM_DISTANCE_SYMBOLS, dynamicCodes.distanceKeys );
+        bitWriter_put( writer, encoder->final, 1 );
+        bitWriter_put( writer, BLOCK_DYNAMIC, 2 );
+        writeDynamicHeader( &header, writer );
+        writeSymbols( encoder->symbols, encoder->numSymbols, &dynamicCodes, writer );
+    }
+    encoder->blockStart = encoder->blockEnd;
+    encoder->numSymbols = 0;
+}
+
+static inline void putSymbol( DeflateEncoder* const encoder, const DeflateSymbol symbol, const uint32_t length ) {
+    encoder->symbols[encoder->numSymbols++] = symbol;
+    encoder->blockEnd += length;
+    if ( encoder->numSymbols == BLOCK_SYMBOLS ) writeBlock( encoder );
+}
+
+//LzSequenceSink collecting symbols into blocks
+static void putSequence( void *context, const uint8_t *literals, const size_t numLiterals, const uint32_t matchLength, const uint32_t distance ) {
+    DeflateEncoder* const encoder = context;
+    for ( size_t i = 0; i < numLiterals; ++i ) {
+        putSymbol( encoder, ( DeflateSymbol ) { .literalLength = literals[i], .distance = 0 }, 1 );
+    }
+    if ( matchLength ) {
+        putSymbol( encoder, ( DeflateSymbol ) { .literalLength = 256 + matchLength, .distance = distance }, matchLength );
+    }
+}
+
+size_t zip_deflateBound( const size_t inputSize ) {
+    //stored blocks are the worst case: at most 6 bytes of header per block
+    //(one per BLOCK_SYMBOLS input bytes) or per MAX_STORED_SIZE chunk
+    return inputSize + inputSize / 2048 + 64 + BITSTREAM_SLACK;
+}
+
+size_t zip_deflate( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity, const uint level, Arena* const arena ) {
+    if ( level < ZIP_MIN_LEVEL || level > ZIP_MAX_LEVEL || inputSize > UINT32_MAX - 1 ) {
+        fprintf( stderr, "Invalid level %u or input size %zu (deflate)\n", level, inputSize );
+        return 0;
+    }
+    if ( outputCapacity < BITSTREAM_SLACK + 2 ) return 0;
+    pthread_once( &tablesOnce, buildTables );
+
+    const size_t mark = arena_mark( arena );
+    DeflateEncoder encoder = {
+                               .input = input,
+                               .symbols = arena_alloc( arena, sizeof( DeflateSymbol ) * BLOCK_SYMBOLS ),
+                               .writer = bitWriter_create( output, outputCapacity )
+                             };
+    if ( !encoder.symbols ) {
+        fprintf( stderr, "Cannot allocate symbols (deflate)\n" );
+        return 0;
+    }
+    const LzParams params = { .level = level, .windowLog = WINDOW_LOG };
+    if ( inputSize && !lz_parse( input, inputSize, &params, MAX_MATCH, putSequence, &encoder, arena ) ) encoder.failed = true;
+    encoder.final = true;
+    writeBlock( &encoder );
+    arena_release( arena, mark );
+    return encoder.failed ? 0 : bitWriter_finish( &encoder.writer );
+}
+
+size_t zip_gzipBound( const size_t inputSize ) {
+    return GZIP_HEADER_SIZE + zip_deflateBound( inputSize ) + GZIP_TRAILER_SIZE;
+}
+
+size_t zip_gzip( const uint8_t *input, const size_t inputSize, uint8_t *output, const size_t outputCapacity, const uint level, Arena* const arena ) {
+    if ( outputCapacity < GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE ) return 0;
+    //no name, no modification time, unix; the extra flags say slowest or fastest level
+    static const uint8_t header[GZIP_HEADER_SIZE] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 3 };
+    memcpy( output, header, GZIP_HEADER_SIZE );
+    output[8] = level == ZIP_MAX_LEVEL ? 2 : level == ZIP_MIN_LEVEL ? 4 : 0;
+
+    const size_t deflatedSize = zip_deflate( input, inputSize, output + GZIP_HEADER_SIZE, outputCapacity - GZIP_HEADER_SIZE - GZIP_TRAILER_SIZE, level,
+                                             arena );
+    if ( !deflatedSize ) return 0;
+    uint8_t *trailer = output + GZIP_HEADER_SIZE + deflatedSize;
+    writeLE32( trailer, zip_crc32( 0, input, inputSize ) );
+    writeLE32( trailer + 4, inputSize );
+    return GZIP_HEADER_SIZE + deflatedSize + GZIP_TRAILER_SIZE;
+}
+
+ZipWriter *zipWriter_create( OutputFile *output, const uint level ) {
+    if ( level < ZIP_MIN_LEVEL || level > ZIP_MAX_LEVEL ) {
+        fprintf( stderr, "Invalid level %u (zip)\n", level );
+        return NULL;
+    }
+    ZipWriter *writer = calloc( 1, sizeof( ZipWriter ) );
+    if ( writer ) writer->arena = arena_create( 0 );
+    if ( !writer || !writer->arena ) {
+        free( writer );
+        return NULL;
+    }
+    writer->output = output;
+    writer->level = level;
+
+    //every entry is stamped with the time the archive was started, DOS style
+    const time_t now = time( NULL );
+    struct tm local;
+    if ( localtime_r( &now, &local ) && local.tm_year >= 80 ) {
+        writer->dosTime = local.tm_hour << 11 | local.tm_min << 5 | local.tm_sec / 2;
+        writer->dosDate = ( local.tm_year - 80 ) << 9 | ( local.tm_mon + 1 ) << 5 | local.tm_mday;
+    } else {
+        writer->dosDate = 1 << 5 | 1; //1980-01-01
+    }
+    return writer;
+}
+
+//fields shared by the local and the central header, from version needed on
+static void writeEntryFields( const ZipWriter* const writer, const ZipEntry* const entry, uint8_t* const output ) {
+    writeLE16( output, ZIP_VERSION );
+    writeLE16( output + 2, 0 );
+    writeLE16( output + 4, entry->method );
+    writeLE16( output + 6, writer->dosTime );
+    writeLE16( output + 8, writer->dosDate );
+    writeLE32( output + 10, entry->crc );
+    writeLE32( output + 14, entry->compressedSize );
+    writeLE32( output + 18, entry->size );
+    writeLE16( output + 22, strlen( entry->name ) );
+    writeLE16( output + 24, 0 );
+}
+
+bool zipWriter_add( ZipWriter* const writer, const char *name, const uint8_t *data, const size_t dataSize ) {
+    const size_t nameLength = strlen( name );
+    if ( writer->numEntries == ZIP_MAX_ENTRIES || dataSize >= UINT32_MAX || nameLength > UINT16_MAX ) {
+        fprintf( stderr, "Too many entries or entry too large (zip)\n" );
+        return false;
+    }
+    if ( writer->numEntries == writer->entriesCapacity ) {
+        const uint capacity = writer->entriesCapacity ? writer->entriesCapacity * 2 : 16;
+        ZipEntry *entries = realloc( writer->entries, sizeof( ZipEntry ) * capacity );
+        if ( !entries ) return false;
+        writer->entries = entries;
+        writer->entriesCapacity = capacity;
+    }
+
+    //the deflated copy only lives until the entry is written
+    arena_reset( writer->arena );
+    const size_t capacity = zip_deflateBound( dataSize );
+    uint8_t *deflated = arena_alloc( writer->arena, capacity );
+    char *entryName = strdup( name );
+    if ( !deflated || !entryName ) {
+        fprintf( stderr, "Cannot allocate buffers (zip)\n" );
+        free( entryName );
+        return false;
+    }
+    const size_t deflatedSize = zip_deflate( data, dataSize, deflated, capacity, writer->level, writer->arena );
+    const bool stored = !deflatedSize || deflatedSize >= dataSize;
+    ZipEntry entry = {
+                       .name = entryName,
+                       .crc = zip_crc32( 0, data, dataSize ),
+                       .compressedSize = stored ? dataSize : deflatedSize,
+                       .size = dataSize,
+                       .offset = writer->offset,
+                       .method = stored ? ZIP_METHOD_STORED : ZIP_METHOD_DEFLATED
+                     };
+    const uint64_t entryEnd = ( uint64_t ) writer->offset + ZIP_LOCAL_HEADER_SIZE + nameLength + entry.compressedSize;
+
+    uint8_t header[ZIP_LOCAL_HEADER_SIZE];
+    writeLE32( header, 0x04034B50 );
+    writeEntryFields( writer, &entry, header + 4 );
+    const bool written = entryEnd < UINT32_MAX &&
+                         outputFile_write( writer->output, header, ZIP_LOCAL_HEADER_SIZE ) &&
+                         outputFile_write( writer->output, name, nameLength ) &&
+                         outputFile_write( writer->output, stored ? data : deflated, entry.compressedSize );
+    if ( !written ) {
+        fprintf( stderr, "Cannot write entry %s (zip)\n", name );
+        free( entryName );
+        return false;
+    }
+    writer->entries[writer->numEntries++] = entry;
+    writer->offset = entryEnd;
+    return true;
+}
+
+bool zipWriter_finish( ZipWriter* const writer ) {
+    bool success = true;
+    const uint32_t directoryOffset = writer->offset;
+    uint64_t directorySize = 0;
+    for ( uint i = 0; i < writer->numEntries; ++i ) {
+        const ZipEntry* const entry = &writer->entries[i];
+        const size_t nameLength = strlen( entry->name );
+        uint8_t header[ZIP_CENTRAL_HEADER_SIZE] = {0};
+        writeLE32( header, 0x02014B50 );
+        writeLE16( header + 4, 3 << 8 | ZIP_VERSION ); //made by unix
+        writeEntryFields( writer, entry, header + 6 );
+        //comment length, disk, internal attributes stay 0
+        writeLE32( header + 38, 0100644u << 16 );
+        writeLE32( header + 42, entry->offset );
+        success = success && outputFile_write( writer->output, header, ZIP_CENTRAL_HEADER_SIZE ) &&
+                  outputFile_write( writer->output, entry->name, nameLength );
+        directorySize += ZIP_CENTRAL_HEADER_SIZE + nameLength;
+        free( entry->name );
+    }
+
+    uint8_t end[ZIP_END_SIZE] = {0};
+    writeLE32( end, 0x06054B50 );
+    writeLE16( end + 8, writer->numEntries );
+    writeLE16( end + 10, writer->numEntries );
+    writeLE32( end + 12, directorySize );
+    writeLE32( end + 16, directoryOffset );
+    success = success && directoryOffset + directorySize < UINT32_MAX &&
+              outputFile_write( writer->output, end, ZIP_END_SIZE );
+    if ( !success ) fprintf( stderr, "Cannot write central directory (zip)\n" );
+
+    free( writer->entries );
+    arena_close( writer->arena );
+    free( writer );
+    return success;
+}
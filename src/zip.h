@@ -1,4 +1,47 @@
 #ifndef ZIP_H
 #define ZIP_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "arena.h"
+#include "fileio.h"
+
+/*
+* DEFLATE (RFC 1951) encoder and the gzip (RFC 1952) and ZIP containers
+* around it, so the output opens with stock tools. Matches come from the lz
+* match finder with a 32 KiB window, blocks are dynamic Huffman, fixed
+* Huffman or stored, whichever is smallest.
+*/
+#define ZIP_MIN_LEVEL 1
+#define ZIP_MAX_LEVEL 9
+#define ZIP_DEFAULT_LEVEL 6
+
+//CRC-32 as used by gzip and ZIP, pass 0 to start and the previous result to continue
+uint32_t zip_crc32( uint32_t crc, const uint8_t *input, size_t inputSize );
+
+//output capacity zip_deflate can never run out of
+size_t zip_deflateBound( size_t inputSize );
+
+//raw DEFLATE stream, returns bytes written or 0 on bad level, oversized input
+//or allocation failure; the match finder and symbol buffer come from arena
+size_t zip_deflate( const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputCapacity, uint level, Arena *arena );
+
+//output capacity zip_gzip can never run out of
+size_t zip_gzipBound( size_t inputSize );
+
+//a single member gzip file, same return as zip_deflate
+size_t zip_gzip( const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputCapacity, uint level, Arena *arena );
+
+/*
+* Writes a ZIP archive to a file one entry at a time, the central directory
+* goes out in zipWriter_finish. Entries are deflated, or stored if that is
+* smaller. No ZIP64, so entries and the archive stay under 4 GiB.
+*/
+typedef struct ZipWriter ZipWriter;
+
+ZipWriter *zipWriter_create( OutputFile *output, uint level );
+bool zipWriter_add( ZipWriter *writer, const char *name, const uint8_t *data, size_t dataSize );
+//writes the central directory and frees the writer, the output stays open
+bool zipWriter_finish( ZipWriter *writer );
 
 #endif